@@ -25,56 +25,481 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/power.h>
+#include <avr/pgmspace.h>
 #include <util/atomic.h>
+#include <util/delay.h>
+#include <util/twi.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
+
+#if defined(OLED_PROFILE)
+/***** Profiling counters *****/
+OLED_prof OLED_prof_data;
+/* Pixels drawn by display list render, which runs in transport ISR. Draws  */
+/* from thread add to OLED_prof_data.pixels without atomic block, so ISR    */
+/* leaves that counter as it was, as if it had not interrupted the update   */
+static uint32_t prof_isr_pixels;
+
+
+void OLED_prof_read(OLED_prof *dst, bool is_reset)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (NULL != dst) {
+			*dst = OLED_prof_data;
+			dst->pixels += prof_isr_pixels;
+		}
+		if (is_reset) {
+			memset(&OLED_prof_data, 0, sizeof OLED_prof_data);
+			prof_isr_pixels = 0;
+		}
+	}
+}
+#endif
 
 #if !defined(OLED_NO_I2C)
-/***** I2C-related logic *****/
-uint8_t OLED_cmdbuffer[OLED_CMDBUFFER_LEN];
-
-static uint8_t _i2c_cmd_init[] = {
-	0x80, 0x8D, 0x80, 0x14	/* Enable charge pump	 */
-	,0x80, 0xAF		/* Display on	      	 */
-	,0x80, 0x81, 0x80, 0xFF /* Set brightness to 255 */
-	,0x80, 0xA7		/* Enable inversion 	 */
+/***** Transport-related logic *****/
+static const uint8_t _i2c_cmd_init[] = {
+	0x8D, 0x14		/* Enable charge pump	 	*/
+	,0xAF			/* Display on	      	 	*/
+	,0x81, 0xFF 		/* Set brightness to 255 	*/
+	,0xA7			/* Enable inversion 	 	*/
+	,0x20, 0x00		/* Horizontal addressing 	*/
+	,0x40			/* Start line is 0		*/
 };
 
-static uint8_t _i2c_cmd_setpage[] = {
-	0x80, 0x00, 0x80, 0x10, /* Set column cursor to 0 */
-	0x80, 0xB0 /* Last nibble in 0xB0 defines page (0xB0..0xB7) */
-};
+/* Init is sent as a single batch, followed by geometry and address window */
+_Static_assert(OLED_CMDBUFFER_LEN >= 1 + sizeof _i2c_cmd_init + 4 + 6,
+	       "OLED: OLED_CMDBUFFER_LEN is too small to hold init sequence");
+
+static uint8_t _i2c_cmd_dataprefix[] = {0x40};
 
-static uint8_t _i2c_cmd_setbrightness[] = {
-	0x80, 0x81, 0x80, 0xFF  /* Last byte is brightness level (0..255) */
+/* Pending transaction. SPI ISR advances pointers and counters in place.	     */
+/* Prefix always starts with I2C control byte: 0x00 when the rest of bytes   */
+/* are commands, 0x40 when they are data. SPI transport does not send it,    */
+/* but drives D/C# line accordingly. For SPI data which follows commands is  */
+/* sent with D/C# high. For I2C it needs commands to be prefixed with 0x80   */
+/* (Co bit) each, ended by 0x40 control byte (see OLED_writewindow_)	     */
+struct OLED_tx_s {
+	uint8_t devaddr;	/* Address already shifted to SLA+W form */
+	uint8_t prefix_count;
+	uint8_t *prefix_ptr;
+	uint8_t *data_ptr;
+	uint16_t data_count;
+	bool is_fastfail;	/* Do not retry on error, report it at once */
+	bool is_read;		/* I2C only. Prefix is written, then data read */
+	void (*callback)(void *, OLED_err); /* called after transaction finish */
+	void *callback_args;
 };
 
-static uint8_t _i2c_cmd_dataprefix[] = {0x40};
+/* Ring queue of transactions. Head is the one being transmitted.	   */
+/* It also serves as bus arbiter for several displays: each refresh keeps   */
+/* at most one transaction queued, queuing the next one from its callback,  */
+/* so page writes of different displays are interleaved in round robin	   */
+static struct OLED_tx_s tx_queue[OLED_I2C_QUEUE_LEN];
+static uint8_t tx_queue_head;
+static uint8_t tx_queue_tail;
+static volatile uint8_t tx_queue_count;
+
+
+/* Set while transaction callback runs. It may reload the slot of finished  */
+/* transaction with the next one once (see OLED_tx_next_)		     */
+static bool tx_is_in_cbk;
+static bool tx_is_chained;
+
+
+static inline ALWAYSINLINE void OLED_tx_fill_(struct OLED_tx_s *tx, uint8_t addr, uint8_t *prefix,
+					      uint8_t prefix_len, uint8_t *bytes, uint16_t bytes_len,
+					      void (*end_cbk)(void *, OLED_err), void *cbk_args,
+					      bool fastfail)
+{
+	tx->devaddr = (addr << 1);
+	tx->prefix_ptr = prefix;
+	tx->prefix_count = prefix_len;
+	tx->data_ptr = bytes;
+	tx->data_count = bytes_len;
+	tx->is_fastfail = fastfail;
+	tx->is_read = false;
+	tx->callback = end_cbk;
+	tx->callback_args = cbk_args;
+	OLED_PROFWRAP(
+		OLED_prof_data.bytes += bytes_len + ((NULL != prefix) ? prefix_len : 0);
+		OLED_prof_data.transactions++;
+	)
+}
+
+
+/* Called by transport ISR when transaction at queue head is over. Slot is  */
+/* kept while its callback runs, so callback could chain the next one into  */
+/* it without waiting for a free one. Chained transaction is moved to the   */
+/* back, so that displays are still served in round robin. Transport must   */
+/* not report itself idle meanwhile, so that tx_shed does not start it.	     */
+/* err is passed to callback. Returns true if there are more transactions    */
+static inline ALWAYSINLINE bool OLED_tx_finish_(OLED_err err)
+{
+	uint8_t head = tx_queue_head;
+	struct OLED_tx_s *tx = &tx_queue[head];
+	/* signal with callback that transaction is over */
+	if (NULL != tx->callback) {
+		tx_is_in_cbk = true;
+		tx_is_chained = false;
+		(*tx->callback)(tx->callback_args, err);
+		tx_is_in_cbk = false;
+	}
+	if (!tx_is_chained) {
+		if (++tx_queue_head >= OLED_I2C_QUEUE_LEN)
+			tx_queue_head = 0;
+		tx_queue_count--;
+	} else if (tx_queue_count > 1) {
+		/* Tail is the head itself when queue is full */
+		tx_queue[tx_queue_tail] = *tx;
+		if (++tx_queue_head >= OLED_I2C_QUEUE_LEN)
+			tx_queue_head = 0;
+		if (++tx_queue_tail >= OLED_I2C_QUEUE_LEN)
+			tx_queue_tail = 0;
+	}
+	tx_is_chained = false;
+	return tx_queue_count != 0;
+}
+
+
+#if defined(OLED_SPI) && defined(__AVR_XMEGA__)
+/***** XMEGA SPI transport (USART in master SPI mode fed by DMA) *****/
+/* Each transaction costs at most two DMA block transfers: one for commands */
+/* in prefix and one for data. CPU is interrupted only at their completion, */
+/* instead of on every byte						    */
+static volatile bool xspi_is_busy = false;
+static bool xspi_is_data_pending;	/* Data block follows prefix block */
+
+
+static void XSPI_init(uint32_t hz_freq)
+{
+	static bool is_init = false;
+	if (is_init)
+		return;
+	is_init = true;
+
+	xspi_is_busy = false;
+	tx_queue_head = tx_queue_tail = tx_queue_count = 0;
+	OLED_XSPI_POWER_ENABLE();
+	PR.PRGEN &= ~PR_DMA_bm;
+
+	/* Chip select is inactive high */
+	OLED_XSPI_CS_PORT.OUTSET = OLED_XSPI_CS_bm;
+	OLED_XSPI_CS_PORT.DIRSET = OLED_XSPI_CS_bm;
+	OLED_XSPI_DC_PORT.DIRSET = OLED_XSPI_DC_bm;
+	OLED_XSPI_PORT.DIRSET = OLED_XSPI_XCK_bm | OLED_XSPI_TXD_bm;
+
+	/* Master SPI mode 0, MSB first. f = F_CPU / (2 * (BSEL + 1)) */
+	uint16_t bsel = F_CPU / (2 * hz_freq);
+	bsel = bsel ? bsel - 1 : 0;
+	OLED_XSPI_USART.BAUDCTRLA = bsel & 0xFF;
+	OLED_XSPI_USART.BAUDCTRLB = (bsel >> 8) & 0x0F;
+	OLED_XSPI_USART.CTRLC = USART_CMODE_MSPI_gc;
+	OLED_XSPI_USART.CTRLB = USART_TXEN_bm;
+
+	/* One byte per data register empty trigger, into fixed USART DATA */
+	DMA.CTRL = DMA_ENABLE_bm;
+	DMA_CH_t *ch = &OLED_XSPI_DMA_CH;
+	ch->ADDRCTRL = DMA_CH_SRCRELOAD_NONE_gc | DMA_CH_SRCDIR_INC_gc |
+		       DMA_CH_DESTRELOAD_NONE_gc | DMA_CH_DESTDIR_FIXED_gc;
+	ch->TRIGSRC = OLED_XSPI_DMA_TRIG;
+	uintptr_t dest = (uintptr_t)&OLED_XSPI_USART.DATA;
+	ch->DESTADDR0 = dest & 0xFF;
+	ch->DESTADDR1 = (dest >> 8) & 0xFF;
+	ch->DESTADDR2 = 0;
+	ch->CTRLB = DMA_CH_TRNINTLVL_LO_gc;
+	PMIC.CTRL |= PMIC_LOLVLEN_bm;
+}
+
+
+/* Starts DMA block transfer of len (> 0) bytes from ptr to USART */
+static void XSPI_dma_block_(uint8_t *ptr, uint16_t len)
+{
+	DMA_CH_t *ch = &OLED_XSPI_DMA_CH;
+	uintptr_t src = (uintptr_t)ptr;
+	ch->SRCADDR0 = src & 0xFF;
+	ch->SRCADDR1 = (src >> 8) & 0xFF;
+	ch->SRCADDR2 = 0;
+	ch->TRFCNT = len;
+	ch->CTRLA = DMA_CH_ENABLE_bm | DMA_CH_SINGLE_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+}
+
+
+/* Selects the chip, sets D/C# from control byte and starts DMA of the	    */
+/* transaction at queue head						    */
+static void XSPI_begin_(void)
+{
+	struct OLED_tx_s *tx = &tx_queue[tx_queue_head];
+	xspi_is_busy = true;
+	if (*tx->prefix_ptr & 0x40)
+		OLED_XSPI_DC_PORT.OUTSET = OLED_XSPI_DC_bm;	/* Data */
+	else
+		OLED_XSPI_DC_PORT.OUTCLR = OLED_XSPI_DC_bm;	/* Commands */
+	OLED_XSPI_CS_PORT.OUTCLR = OLED_XSPI_CS_bm;
+	OLED_XSPI_USART.STATUS = USART_TXCIF_bm;	/* Clear stale flag */
+	/* Control byte itself is not sent */
+	uint8_t prefix_count = tx->prefix_count - 1;
+	xspi_is_data_pending = false;
+	if (prefix_count) {
+		xspi_is_data_pending = (tx->data_count != 0);
+		XSPI_dma_block_(tx->prefix_ptr + 1, prefix_count);
+	} else {
+		XSPI_dma_block_(tx->data_ptr, tx->data_count);
+	}
+}
+
+
+static inline ALWAYSINLINE void OLED_tx_init_(uint32_t hz_freq)
+{
+	XSPI_init(hz_freq);
+}
+
+
+static inline ALWAYSINLINE bool OLED_tx_is_idle_(void)
+{
+	return !xspi_is_busy;
+}
+
+
+static inline ALWAYSINLINE void OLED_tx_start_(void)
+{
+	XSPI_begin_();
+}
+
+
+/* SPI has no acknowledge and could not get stuck, nothing to time out */
+static inline ALWAYSINLINE void OLED_tx_tick_(void)
+{
+}
+
+
+ISR(OLED_XSPI_DMA_vect, ISR_BLOCK)
+{
+	OLED_PROFWRAP(uint16_t prof_start = OLED_PROF_TIMER;)
+	struct OLED_tx_s *tx = &tx_queue[tx_queue_head];
+	OLED_XSPI_DMA_CH.CTRLB |= DMA_CH_TRNIF_bm;
+	if (xspi_is_data_pending) {
+		/* Data follows commands. D/C# is sampled on the last bit of   */
+		/* each byte, so it is switched when the last command is out  */
+		xspi_is_data_pending = false;
+		while (!(OLED_XSPI_USART.STATUS & USART_TXCIF_bm));
+		OLED_XSPI_USART.STATUS = USART_TXCIF_bm;
+		OLED_XSPI_DC_PORT.OUTSET = OLED_XSPI_DC_bm;
+		XSPI_dma_block_(tx->data_ptr, tx->data_count);
+		OLED_PROFWRAP(OLED_prof_data.isr_ticks += (uint16_t)(OLED_PROF_TIMER - prof_start);)
+		return;
+	}
+	/* DMA is done when last byte is written to USART. Wait for it to be */
+	/* shifted out (at most two bytes time), then deselect		     */
+	while (!(OLED_XSPI_USART.STATUS & USART_TXCIF_bm));
+	OLED_XSPI_CS_PORT.OUTSET = OLED_XSPI_CS_bm;
+	if (OLED_tx_finish_(OLED_EOK))
+		XSPI_begin_();
+	else
+		xspi_is_busy = false;
+	OLED_PROFWRAP(OLED_prof_data.isr_ticks += (uint16_t)(OLED_PROF_TIMER - prof_start);)
+}
+
+
+#elif defined(OLED_SPI)
+/***** SPI transport *****/
+static volatile bool spi_is_busy = false;
+
+
+static void SPI_init(uint32_t hz_freq)
+{
+	static bool is_init = false;
+	if (is_init)
+		return;
+	is_init = true;
+
+	spi_is_busy = false;
+	tx_queue_head = tx_queue_tail = tx_queue_count = 0;
+	power_spi_enable();
+
+	/* Chip select is inactive high. SS must be output for master mode */
+	OLED_SPI_CS_PORT |= (1 << OLED_SPI_CS_BIT);
+	OLED_SPI_CS_DDR |= (1 << OLED_SPI_CS_BIT);
+	OLED_SPI_DC_DDR |= (1 << OLED_SPI_DC_BIT);
+	OLED_SPI_DDR |= (1 << OLED_SPI_MOSI) | (1 << OLED_SPI_SCK) | (1 << OLED_SPI_SS);
+
+#if defined(OLED_SPI_RST_PORT)
+	/* Hardware reset pulse, at least 3 us as per datasheet */
+	OLED_SPI_RST_DDR |= (1 << OLED_SPI_RST_BIT);
+	OLED_SPI_RST_PORT &= ~(1 << OLED_SPI_RST_BIT);
+	_delay_us(10);
+	OLED_SPI_RST_PORT |= (1 << OLED_SPI_RST_BIT);
+	_delay_us(10);
+#endif
+
+	/* Select the smallest divider 2^shift (2..128), giving <= hz_freq */
+	uint8_t shift;
+	for (shift = 1; (shift < 7) && ((F_CPU >> shift) > hz_freq); shift++);
+	/* Odd shifts are made with SPI2X. 128 has no doubled counterpart */
+	bool is_2x = (shift & 1) && (shift < 7);
+	uint8_t spr = is_2x ? (shift - 1) / 2 : (shift - 2) / 2;
+	if (shift >= 7)
+		spr = 3;
+
+	SPSR = is_2x ? (1 << SPI2X) : 0;
+	/* Mode 0, MSB first, master */
+	SPCR = (1 << SPIE) | (1 << SPE) | (1 << MSTR) | (spr & 0x03);
+}
+
+
+/* Selects the chip, sets D/C# from control byte and sends the first byte of */
+/* transaction at queue head. Next ones are sent from ISR		     */
+static void SPI_begin_(void)
+{
+	struct OLED_tx_s *tx = &tx_queue[tx_queue_head];
+	spi_is_busy = true;
+	if (*tx->prefix_ptr & 0x40)
+		OLED_SPI_DC_PORT |= (1 << OLED_SPI_DC_BIT);	/* Data */
+	else
+		OLED_SPI_DC_PORT &= ~(1 << OLED_SPI_DC_BIT);	/* Commands */
+	tx->prefix_ptr++;
+	tx->prefix_count--;
+	OLED_SPI_CS_PORT &= ~(1 << OLED_SPI_CS_BIT);
+	if (tx->prefix_count) {
+		tx->prefix_count--;
+		SPDR = *tx->prefix_ptr++;
+	} else {
+		tx->data_count--;
+		SPDR = *tx->data_ptr++;
+	}
+}
+
+
+static inline ALWAYSINLINE void OLED_tx_init_(uint32_t hz_freq)
+{
+	SPI_init(hz_freq);
+}
+
+
+static inline ALWAYSINLINE bool OLED_tx_is_idle_(void)
+{
+	return !spi_is_busy;
+}
+
+
+static inline ALWAYSINLINE void OLED_tx_start_(void)
+{
+	SPI_begin_();
+}
 
-static uint8_t i2c_devaddr;
-static uint8_t *i2c_prefix_ptr;
-static uint8_t *i2c_prefix_count;
-static uint8_t *i2c_data_ptr;
-static uint16_t i2c_data_count;
-static bool i2c_is_fastfail;
-static void (*i2c_callback)(void *); /* called after transaction finish */
-static void *i2c_callback_args;
 
-/* States used in ISR FSM */
+/* SPI has no acknowledge and could not get stuck, nothing to time out */
+static inline ALWAYSINLINE void OLED_tx_tick_(void)
+{
+}
+
+
+ISR(SPI_STC_vect, ISR_BLOCK)
+{
+	OLED_PROFWRAP(uint16_t prof_start = OLED_PROF_TIMER;)
+	struct OLED_tx_s *tx = &tx_queue[tx_queue_head];
+	if (tx->prefix_count) {
+		tx->prefix_count--;
+		SPDR = *tx->prefix_ptr++;
+	} else if (tx->data_count) {
+		/* Data may follow commands, e.g. address window */
+		OLED_SPI_DC_PORT |= (1 << OLED_SPI_DC_BIT);
+		tx->data_count--;
+		SPDR = *tx->data_ptr++;
+	} else {
+		/* Deselect, so that display ends the transaction */
+		OLED_SPI_CS_PORT |= (1 << OLED_SPI_CS_BIT);
+		if (OLED_tx_finish_(OLED_EOK))
+			SPI_begin_();
+		else
+			spi_is_busy = false;
+	}
+	OLED_PROFWRAP(OLED_prof_data.isr_ticks += (uint16_t)(OLED_PROF_TIMER - prof_start);)
+}
+
+
+#else
+/***** I2C transport *****/
+/* Transaction is sent as a chain of up to two segments: prefix, then data.  */
+/* Segment being sent is kept in i2c_ptr/i2c_left. For each byte ISR only    */
+/* checks that previous one was acknowledged and that segment is not over,   */
+/* falling to I2C_step_() FSM otherwise. It handles address, segment	     */
+/* boundaries, repeated START/STOP and errors.				     */
+/* Read transaction (see OLED_i2c_read) writes prefix, if any, then reads    */
+/* data after repeated START. Its bytes are all received by I2C_step_()	     */
+/*									     */
+/* Worst case per data byte (ATmega, counted from interrupt request to reti, */
+/* including 4 cycles response and 3 cycles vector jump):		     */
+/*  - OLED_I2C_NAKED_ISR: 68 cycles, interrupts blocked for all of them.     */
+/*    Only SREG, r24, r25, r30, r31 are saved on the fast path		     */
+/*  - default C handler: about 40 cycles more, as avr-gcc saves and restores */
+/*    all call-clobbered registers on each entry because step calls the     */
+/*    transaction callbacks						     */
+/* At 400 kHz byte takes 22.5 us (360 cycles at 16 MHz) on the bus	     */
+/*									     */
+/* On NACK, arbitration loss or bus error transaction which is not fastfail  */
+/* is restarted from the START up to I2C_MAX_RETRIES times. Otherwise it is  */
+/* dropped and its callback gets the error. So only transactions which could */
+/* be safely sent twice (i.e. commands, not data) should be retried	     */
+#define I2C_MAX_RETRIES 2
+
 enum I2C_State_e {
 	I2C_STATE_IDLE = 0,
-	I2C_STATE_STOP,
-	I2C_STATE_SLAVEADDR,
-	I2C_STATE_WRITEPREFIX,
-	I2C_STATE_WRITEBYTE
+	I2C_STATE_SLAVEADDR,	/* START is being sent */
+	I2C_STATE_ADDR,		/* SLA+W or SLA+R is being sent */
+	I2C_STATE_WRITE,	/* Segment bytes are being sent */
+	I2C_STATE_READ		/* Data bytes are being received */
 };
-static enum I2C_State_e i2c_state = I2C_STATE_IDLE;
+static volatile enum I2C_State_e i2c_state = I2C_STATE_IDLE;
+
+/* Not volatile: only used by ISR and with interrupts disabled */
+static uint8_t *i2c_ptr;
+static uint16_t i2c_left;
+static uint8_t *i2c_next_ptr;
+static uint16_t i2c_next_left;
+static uint8_t i2c_retries;
+static bool i2c_is_reading;	/* Read transaction is past its prefix */
+/* Set by ISR on each byte, cleared by tick. Tick counts ticks without it */
+static volatile uint8_t i2c_is_alive;
+static uint8_t i2c_stuck_ticks;
+
+/* TWCR is written directly, as all of its control bits are known */
+#define I2C_TWCR_SEND	((1 << TWEN) | (1 << TWIE) | (1 << TWINT))
+#define I2C_TWCR_START	(I2C_TWCR_SEND | (1 << TWSTA))
+#define I2C_TWCR_STOP	(I2C_TWCR_SEND | (1 << TWSTO))
+#define I2C_TWCR_ACK	(I2C_TWCR_SEND | (1 << TWEA))	/* Receive, then ACK */
 
+#if defined(OLED_I2C_IGNORE_NACK)
+/* Simulator has no device on the bus: NACK of written byte counts as ACK */
+static inline ALWAYSINLINE uint8_t I2C_status_(void)
+{
+	uint8_t status = TW_STATUS;
+	if (TW_MT_SLA_NACK == status)
+		return TW_MT_SLA_ACK;
+	if (TW_MT_DATA_NACK == status)
+		return TW_MT_DATA_ACK;
+	return status;
+}
+#else
+#define I2C_status_() TW_STATUS
+#endif
 
+
+/* Bus is shared by all displays, so it is set up only by the first init */
 static void I2C_init(uint32_t hz_freq)
 {
+	static bool is_init = false;
+	if (is_init)
+		return;
+	is_init = true;
+
 	i2c_state = I2C_STATE_IDLE;
+	i2c_left = i2c_next_left = 0;
+	i2c_retries = 0;
+	i2c_is_reading = false;
+	tx_queue_head = tx_queue_tail = tx_queue_count = 0;
 	/* Enable the Two Wire Interface module */
 	power_twi_enable();
 
@@ -96,395 +521,1290 @@ static void I2C_init(uint32_t hz_freq)
 }
 
 
-bool OLED_i2c_tx_shed(uint8_t addr, uint8_t *prefix, uint8_t prefix_len, uint8_t *bytes, uint16_t bytes_len, 
-		      void (*end_cbk)(void *), void *cbk_args, bool fastfail)
+static inline ALWAYSINLINE void OLED_tx_init_(uint32_t hz_freq)
 {
-	bool ret = false;
-	/* No interrupts can occur while this block is executed */
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		if (i2c_state == I2C_STATE_IDLE) {
-			i2c_prefix_ptr = prefix;
-			i2c_prefix_count = prefix_len;
-			i2c_data_ptr = bytes;
-			i2c_data_count = bytes_len;
-			i2c_is_fastfail = fastfail;
-			i2c_callback = end_cbk;
-			i2c_callback_args = cbk_args;
-			/* Send START signal and initiating new transaction */
-			i2c_state = I2C_STATE_SLAVEADDR;
-			i2c_devaddr = (addr << 1);
-			TWCR |= (1 << TWSTA) | (1 << TWINT);
-			ret = true;
-		}
+	I2C_init(hz_freq);
+}
+
+
+static inline ALWAYSINLINE bool OLED_tx_is_idle_(void)
+{
+	return i2c_state == I2C_STATE_IDLE;
+}
+
+
+static inline ALWAYSINLINE void OLED_tx_start_(void)
+{
+	/* Send START signal and initiating new transaction */
+	i2c_state = I2C_STATE_SLAVEADDR;
+	i2c_stuck_ticks = 0;
+	TWCR = I2C_TWCR_START;
+}
+
+
+/* Frees slave which holds SDA low, e.g. after reset in the middle of byte: */
+/* clocks SCL until SDA is released (9 pulses at most) and generates STOP.  */
+/* Lines are driven as open drain by switching DDR with PORT bits cleared.  */
+/* Takes ~100 us, which is only spent on errors				    */
+static void I2C_recover_(void)
+{
+	TWCR = 0;	/* Disconnect TWI from pins */
+	uint8_t port = OLED_I2C_PORT;
+	OLED_I2C_PORT &= ~((1 << OLED_I2C_SCL) | (1 << OLED_I2C_SDA));
+	for (uint8_t i = 0; (i < 9) && !(OLED_I2C_PIN & (1 << OLED_I2C_SDA)); i++) {
+		OLED_I2C_DDR |= (1 << OLED_I2C_SCL);
+		_delay_us(5);
+		OLED_I2C_DDR &= ~(1 << OLED_I2C_SCL);
+		_delay_us(5);
 	}
-	return ret;
+	/* SDA rising while SCL is high is the STOP */
+	OLED_I2C_DDR |= (1 << OLED_I2C_SDA);
+	_delay_us(5);
+	OLED_I2C_DDR &= ~(1 << OLED_I2C_SDA);
+	_delay_us(5);
+	OLED_I2C_PORT = port;
+	TWCR = (1 << TWEN) | (1 << TWIE);
 }
 
 
-ISR(TWI_vect, ISR_BLOCK)
+/* Transaction at queue head is over. Starts the next one if any */
+static void I2C_done_(OLED_err err)
 {
-	switch(i2c_state) {
-	case(I2C_STATE_IDLE):
-	case(I2C_STATE_STOP):
+	i2c_left = i2c_next_left = 0;
+	i2c_retries = 0;
+	i2c_is_reading = false;
+	/* State stays non-IDLE while callback runs */
+	if (OLED_tx_finish_(err)) {
+		/* Go straight to the next one with repeated START */
+		i2c_state = I2C_STATE_SLAVEADDR;
+		TWCR = I2C_TWCR_START;
+	} else {
 		/* transfer stop and go to IDLE*/
-		/* signal with callback that transaction is over */
-		TWCR |= (1 << TWSTO) | (1 << TWINT);
 		i2c_state = I2C_STATE_IDLE;
-		(*i2c_callback)(i2c_callback_args);
+		TWCR = I2C_TWCR_STOP;
+	}
+}
+
+
+/* Restarts transaction at queue head or drops it, depending on fastfail */
+static void I2C_fail_(OLED_err err)
+{
+	if (tx_queue[tx_queue_head].is_fastfail || (i2c_retries >= I2C_MAX_RETRIES)) {
+		I2C_done_(err);
+		return;
+	}
+	i2c_retries++;
+	i2c_left = i2c_next_left = 0;
+	i2c_is_reading = false;
+	i2c_state = I2C_STATE_SLAVEADDR;
+	/* STOP followed by START. After arbitration loss START is sent	*/
+	/* only when bus gets free					*/
+	TWCR = I2C_TWCR_STOP | (1 << TWSTA);
+}
+
+
+/* Sends next byte of transaction. Returns false if there are none left */
+static inline ALWAYSINLINE bool I2C_send_next_(void)
+{
+	if (!i2c_left) {
+		if (!i2c_next_left)
+			return false;
+		/* Chain data segment right after the prefix */
+		i2c_ptr = i2c_next_ptr;
+		i2c_left = i2c_next_left;
+		i2c_next_left = 0;
+	}
+	TWDR = *i2c_ptr++;
+	TWCR = I2C_TWCR_SEND;
+	i2c_left--;
+	return true;
+}
+
+
+/* Asks for the next byte to be received, ACKing all but the last one */
+static inline ALWAYSINLINE void I2C_receive_next_(void)
+{
+	TWCR = (i2c_left > 1) ? I2C_TWCR_ACK : I2C_TWCR_SEND;
+}
+
+
+/* Prefix of transaction is over. Read one turns around with repeated START */
+static inline ALWAYSINLINE void I2C_write_done_(struct OLED_tx_s *tx)
+{
+	if (tx->is_read && !i2c_is_reading) {
+		i2c_is_reading = true;
+		i2c_state = I2C_STATE_SLAVEADDR;
+		TWCR = I2C_TWCR_START;
+		return;
+	}
+	I2C_done_(OLED_EOK);
+}
+
+
+/* Slow path of ISR. Called when segment is over or status is not data ACK */
+static void __attribute__((used, noinline)) I2C_step_(void)
+{
+	struct OLED_tx_s *tx = &tx_queue[tx_queue_head];
+	uint8_t status = I2C_status_();
+	i2c_is_alive = 1;
+	if (TW_BUS_ERROR == status) {
+		/* Illegal START/STOP. Only STOP releases TWI from it */
+		TWCR = I2C_TWCR_STOP;
+		if (I2C_STATE_IDLE != i2c_state)
+			I2C_fail_(OLED_EBUS);
+		return;
+	}
+	switch(i2c_state) {
+	case(I2C_STATE_IDLE):
+		/* Spurious. Nothing is being transmitted */
 		break;
 	case(I2C_STATE_SLAVEADDR):
-		// load value
-		TWDR = i2c_devaddr;
-		TWCR = (TWCR & ~(1 << TWSTA)) | (1 << TWINT);
-		if ((NULL == i2c_prefix_ptr) && (NULL == i2c_data_ptr)) {
-			i2c_state = I2C_STATE_STOP;
-		} else if (NULL == i2c_prefix_ptr) {
-			i2c_state = I2C_STATE_WRITEBYTE;
-		} else {
-			i2c_state = I2C_STATE_WRITEPREFIX;
+		if ((TW_START != status) && (TW_REP_START != status)) {
+			I2C_fail_(OLED_EBUS);
+			break;
+		}
+		/* Read without prefix starts with SLA+R right away */
+		if (tx->is_read && ((NULL == tx->prefix_ptr) || !tx->prefix_count))
+			i2c_is_reading = true;
+		TWDR = tx->devaddr | (i2c_is_reading ? TW_READ : TW_WRITE);
+		TWCR = I2C_TWCR_SEND;
+		i2c_state = I2C_STATE_ADDR;
+		break;
+	case(I2C_STATE_ADDR):
+		if (i2c_is_reading) {
+			if (TW_MR_SLA_ACK != status) {
+				I2C_fail_((TW_MR_SLA_NACK == status) ? OLED_ENACK : OLED_EBUS);
+				break;
+			}
+			i2c_ptr = tx->data_ptr;
+			i2c_left = (NULL == tx->data_ptr) ? 0 : tx->data_count;
+			if (!i2c_left) {
+				I2C_done_(OLED_EOK);
+				break;
+			}
+			i2c_state = I2C_STATE_READ;
+			I2C_receive_next_();
+			break;
 		}
+		if (TW_MT_SLA_ACK != status) {
+			I2C_fail_((TW_MT_SLA_NACK == status) ? OLED_ENACK : OLED_EBUS);
+			break;
+		}
+		i2c_ptr = tx->prefix_ptr;
+		i2c_left = (NULL == tx->prefix_ptr) ? 0 : tx->prefix_count;
+		/* Data of read transaction is where bytes are received to */
+		i2c_next_ptr = tx->data_ptr;
+		i2c_next_left = ((NULL == tx->data_ptr) || tx->is_read) ? 0 : tx->data_count;
+		i2c_state = I2C_STATE_WRITE;
+		if (!I2C_send_next_())
+			I2C_write_done_(tx);
 		break;
-	case(I2C_STATE_WRITEPREFIX):
-		// load next byte of prefix
-		TWDR = *i2c_prefix_ptr++;
-		i2c_prefix_count--;
-		TWCR |= (1 << TWINT);
-		if (!i2c_prefix_count) {
-			i2c_state = (NULL == i2c_data_ptr) ? I2C_STATE_STOP : I2C_STATE_WRITEBYTE;
+	case(I2C_STATE_WRITE):
+		if (TW_MT_DATA_ACK != status) {
+			I2C_fail_((TW_MT_DATA_NACK == status) ? OLED_ENACK : OLED_EBUS);
+			break;
 		}
+		if (!I2C_send_next_())
+			I2C_write_done_(tx);
 		break;
-	case(I2C_STATE_WRITEBYTE):
-		// load next byte
-		TWDR = *i2c_data_ptr++;
-		i2c_data_count--;
-		TWCR |= (1 << TWINT);
-		if (!i2c_data_count)
-			i2c_state = I2C_STATE_STOP;
+	case(I2C_STATE_READ):
+		/* Last byte is NACKed by us, the rest are ACKed */
+		if ((TW_MR_DATA_ACK != status) && (TW_MR_DATA_NACK != status)) {
+			I2C_fail_(OLED_EBUS);
+			break;
+		}
+		*i2c_ptr++ = TWDR;
+		if (--i2c_left)
+			I2C_receive_next_();
+		else
+			I2C_done_(OLED_EOK);
 		break;
 	}
 }
 
 
-/* Callback which essentially does nothing */
-static void OLED_cbk_empty(void *args)
+static inline ALWAYSINLINE void OLED_tx_tick_(void)
 {
-	// empty callback
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (I2C_STATE_IDLE == i2c_state) {
+			i2c_stuck_ticks = 0;
+		} else if (i2c_is_alive) {
+			i2c_is_alive = 0;
+			i2c_stuck_ticks = 0;
+		} else if (++i2c_stuck_ticks >= OLED_I2C_TIMEOUT_TICKS) {
+			i2c_stuck_ticks = 0;
+			I2C_recover_();
+			I2C_fail_(OLED_ETIMEOUT);
+		}
+	}
 }
 
 
-/* A dummy callback which simply unlocks the oled lock */
-static void OLED_cbk_unlock(void *args)
+#if defined(OLED_I2C_NAKED_ISR)
+/* Hand-written fast path. Slow path saves the rest of call-clobbered	*/
+/* registers itself, the same way avr-gcc ISR prologue would do		*/
+ISR(TWI_vect, ISR_NAKED)
 {
-	OLED *oled = args;
-	OLED_unlock(oled);
+	asm volatile(
+		"push r24			\n\t"
+		"in r24, __SREG__		\n\t"
+		"push r24			\n\t"
+		"push r25			\n\t"
+		"push r30			\n\t"
+		"push r31			\n\t"
+		"lds r24, %[twsr]		\n\t"
+		"andi r24, %[mask]		\n\t"
+		"cpi r24, %[ack]		\n\t"
+		"brne 1f			\n\t"	/* Not data ACK */
+		"lds r24, %[left]		\n\t"
+		"lds r25, %[left]+1		\n\t"
+		"sbiw r24, 1			\n\t"
+		"brcs 1f			\n\t"	/* Segment is over */
+		"sts %[left]+1, r25		\n\t"
+		"sts %[left], r24		\n\t"
+		"lds r30, %[ptr]		\n\t"
+		"lds r31, %[ptr]+1		\n\t"
+		"ld r24, Z+			\n\t"
+		"sts %[twdr], r24		\n\t"
+		"ldi r24, %[send]		\n\t"
+		"sts %[twcr], r24		\n\t"
+		"sts %[alive], r24		\n\t"	/* Any non-zero */
+		"sts %[ptr]+1, r31		\n\t"
+		"sts %[ptr], r30		\n\t"
+		"rjmp 2f			\n\t"
+	"1:	push r0				\n\t"
+		"push r1			\n\t"
+		"clr r1				\n\t"
+		"push r18			\n\t"
+		"push r19			\n\t"
+		"push r20			\n\t"
+		"push r21			\n\t"
+		"push r22			\n\t"
+		"push r23			\n\t"
+		"push r26			\n\t"
+		"push r27			\n\t"
+		"%~call %x[step]		\n\t"
+		"pop r27			\n\t"
+		"pop r26			\n\t"
+		"pop r23			\n\t"
+		"pop r22			\n\t"
+		"pop r21			\n\t"
+		"pop r20			\n\t"
+		"pop r19			\n\t"
+		"pop r18			\n\t"
+		"pop r1				\n\t"
+		"pop r0				\n\t"
+	"2:	pop r31				\n\t"
+		"pop r30			\n\t"
+		"pop r25			\n\t"
+		"pop r24			\n\t"
+		"out __SREG__, r24		\n\t"
+		"pop r24			\n\t"
+		"reti				\n\t"
+		:
+		: [left] "i" (&i2c_left), [ptr] "i" (&i2c_ptr), [alive] "i" (&i2c_is_alive),
+		  [twsr] "n" (_SFR_MEM_ADDR(TWSR)), [twdr] "n" (_SFR_MEM_ADDR(TWDR)),
+		  [twcr] "n" (_SFR_MEM_ADDR(TWCR)), [mask] "M" (TW_STATUS_MASK),
+		  [ack] "M" (TW_MT_DATA_ACK), [send] "M" (I2C_TWCR_SEND),
+		  [step] "i" (&I2C_step_)
+	);
+}
+#else
+ISR(TWI_vect, ISR_BLOCK)
+{
+	OLED_PROFWRAP(uint16_t prof_start = OLED_PROF_TIMER;)
+	uint16_t left = i2c_left;
+	if (left && (TW_MT_DATA_ACK == I2C_status_())) {
+		uint8_t *ptr = i2c_ptr;
+		TWDR = *ptr++;
+		TWCR = I2C_TWCR_SEND;
+		i2c_is_alive = 1;
+		i2c_ptr = ptr;
+		i2c_left = left - 1;
+	} else {
+		I2C_step_();
+	}
+	OLED_PROFWRAP(OLED_prof_data.isr_ticks += (uint16_t)(OLED_PROF_TIMER - prof_start);)
 }
+#endif // OLED_I2C_NAKED_ISR
+#endif // OLED_SPI
 
 
-/* Callbacks which are used to write each page */
-static void OLED_cbk_writepage(void *args);
-static void OLED_cbk_setwritepage(void *args);
-/* Writes page. This is called after OLED_cbk_setwritepage */
-static void OLED_cbk_writepage(void *args)
+/* Puts transaction to the queue. If transport is idle, it is started	     */
+/* immediately. Otherwise ISR starts it right after the ones queued before   */
+/* (for I2C using repeated START). Returns false if queue is full	     */
+bool OLED_tx_shed(uint8_t addr, uint8_t *prefix, uint8_t prefix_len, uint8_t *bytes, uint16_t bytes_len, 
+		  void (*end_cbk)(void *, OLED_err), void *cbk_args, bool fastfail)
 {
-	OLED *oled = args;
-	if (oled->cur_page >= oled->num_pages) {
-		OLED_unlock(oled);
-		return;
-	}
-	uint8_t *lineptr = &oled->frame_buffer[oled->cur_page * (uint16_t)oled->width];
-	oled->cur_page++;
-	while(!OLED_i2c_tx_shed(oled->i2c_addr, _i2c_cmd_dataprefix, OLED_ARR_SIZE(_i2c_cmd_dataprefix), 
-				lineptr, oled->width,
-				&OLED_cbk_setwritepage, oled, true)) {
-		// nop
+	bool ret = false;
+	/* No interrupts can occur while this block is executed */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (tx_queue_count < OLED_I2C_QUEUE_LEN) {
+			OLED_tx_fill_(&tx_queue[tx_queue_tail], addr, prefix, prefix_len,
+				      bytes, bytes_len, end_cbk, cbk_args, fastfail);
+			if (++tx_queue_tail >= OLED_I2C_QUEUE_LEN)
+				tx_queue_tail = 0;
+			tx_queue_count++;
+			if (OLED_tx_is_idle_())
+				OLED_tx_start_();
+			ret = true;
+		}
 	}
+	return ret;
 }
 
-/* Sets page index and calls OLED_cbk_writepage via callback */
-static void OLED_cbk_setwritepage(void *args)
+
+/* Queues next transaction of a refresh. From transaction callback it is     */
+/* chained into the slot of the one just finished, which ISR sends right     */
+/* away, so there is no waiting in interrupt context. If callback queues    */
+/* more than one (e.g. refreshes of several displays), the rest take free   */
+/* slots, and OLED_EBUSY is returned when there are none, as spinning with  */
+/* interrupts masked would never end. Elsewhere it spins till slot is free  */
+static OLED_err OLED_tx_next_(OLED *oled, uint8_t *prefix, uint8_t prefix_len, uint8_t *bytes,
+			      uint16_t bytes_len, void (*end_cbk)(void *, OLED_err), bool fastfail)
 {
-	OLED *oled = args;
-	_i2c_cmd_setpage[OLED_ARR_SIZE(_i2c_cmd_setpage) - 1] = 0xB0 | oled->cur_page;
-	while(!OLED_i2c_tx_shed(oled->i2c_addr, _i2c_cmd_setpage, 
-                                OLED_ARR_SIZE(_i2c_cmd_setpage), NULL, 0,
-				&OLED_cbk_writepage, oled, true)) {
-		// nop
+	if (tx_is_in_cbk && !tx_is_chained) {
+		tx_is_chained = true;
+		OLED_tx_fill_(&tx_queue[tx_queue_head], oled->i2c_addr, prefix, prefix_len,
+			      bytes, bytes_len, end_cbk, oled, fastfail);
+		return OLED_EOK;
+	}
+	while(!OLED_tx_shed(oled->i2c_addr, prefix, prefix_len, bytes, bytes_len,
+				end_cbk, oled, fastfail)) {
+		if (tx_is_in_cbk)
+			return OLED_EBUSY;
 	}
+	return OLED_EOK;
 }
 
 
+void OLED_tick(void)
+{
+	OLED_tx_tick_();
+}
 
-void OLED_cmd_setbrightness(OLED *oled, uint8_t level)
+
+#if !defined(OLED_SPI)
+/***** I2C bus API for other devices *****/
+/* Transaction of other device is queued like page writes of displays. High */
+/* priority one is put right after the one being sent, moving the rest back, */
+/* so it waits for one transaction at most. Chained ones are moved to the   */
+/* back by OLED_tx_finish_, so it is not overtaken by them		     */
+static OLED_err I2C_request_(uint8_t addr, uint8_t *prefix, uint8_t prefix_len, uint8_t *bytes,
+			     uint16_t len, bool is_read, void (*end_cbk)(void *, OLED_err),
+			     void *cbk_args, bool is_priority)
 {
-	_i2c_cmd_setbrightness[OLED_ARR_SIZE(_i2c_cmd_setbrightness) - 1] = level;
-	OLED_spinlock(oled);
-	while(!OLED_i2c_tx_shed(oled->i2c_addr, _i2c_cmd_setbrightness, 
-                                OLED_ARR_SIZE(_i2c_cmd_setbrightness), NULL, 0,
-				&OLED_cbk_unlock, oled, true)) {
-		// nop
+	OLED_err err = OLED_EBUSY;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (tx_queue_count < OLED_I2C_QUEUE_LEN) {
+			uint8_t slot = tx_queue_tail;
+			/* Head is being sent unless transport is idle */
+			for (uint8_t i = 1; is_priority && (i < tx_queue_count); i++) {
+				uint8_t prev = slot ? slot - 1 : OLED_I2C_QUEUE_LEN - 1;
+				tx_queue[slot] = tx_queue[prev];
+				slot = prev;
+			}
+			/* Bus state is not known to the app, so error is reported */
+			OLED_tx_fill_(&tx_queue[slot], addr, prefix, prefix_len, bytes, len,
+				      end_cbk, cbk_args, true);
+			tx_queue[slot].is_read = is_read;
+			if (++tx_queue_tail >= OLED_I2C_QUEUE_LEN)
+				tx_queue_tail = 0;
+			tx_queue_count++;
+			if (OLED_tx_is_idle_())
+				OLED_tx_start_();
+			err = OLED_EOK;
+		}
 	}
+	return err;
 }
 
 
-void OLED_refresh(OLED *oled)
+void OLED_i2c_init(uint32_t hz_freq)
 {
-	OLED_spinlock(oled);
-	/* Code below is executed under lock */
-	oled->cur_page = 0;
-	OLED_cbk_setwritepage(oled);
-	/* Lock is unlocked after series of callbacks, in the last one */
+	I2C_init(hz_freq);
 }
-#endif // OLED_NO_I2C
 
 
-/***** Display-related logic *****/
-OLED_err __OLED_init(OLED *oled, uint8_t width, uint8_t height, uint8_t *frame_buffer, uint32_t i2c_freq_hz, uint8_t i2c_addr)
+OLED_err OLED_i2c_write(uint8_t addr, uint8_t *prefix, uint8_t prefix_len, uint8_t *bytes,
+			uint16_t len, void (*end_cbk)(void *, OLED_err), void *cbk_args,
+			bool is_priority)
 {
-	oled->width = width;
-	oled->height = height;
-	oled->frame_buffer = frame_buffer;
-	oled->busy_lock = 1;	/* Initially: 1 - unlocked */
-
-	OLED_I2CWRAP(
-		oled->i2c_addr = i2c_addr;
-		oled->cur_page = 0;
-		oled->num_pages = 8;
+	return I2C_request_(addr, prefix, prefix_len, bytes, len, false, end_cbk, cbk_args,
+			    is_priority);
+}
 
-		I2C_init(i2c_freq_hz);
-		
-		if (!OLED_i2c_tx_shed(oled->i2c_addr, _i2c_cmd_init, OLED_ARR_SIZE(_i2c_cmd_init),
-				      NULL, 0, OLED_cbk_empty, NULL, true)) {
-			return OLED_EBUSY;
-		}
-	) // OLED_I2CWRAP
 
-	return OLED_EOK;
+OLED_err OLED_i2c_read(uint8_t addr, uint8_t *reg, uint8_t reg_len, uint8_t *bytes,
+		       uint16_t len, void (*end_cbk)(void *, OLED_err), void *cbk_args,
+		       bool is_priority)
+{
+	return I2C_request_(addr, reg, reg_len, bytes, len, true, end_cbk, cbk_args,
+			    is_priority);
 }
+#endif // OLED_SPI
 
 
-OLED_err OLED_put_pixel(OLED *oled, uint8_t x, uint8_t y, bool pixel_state)
+/* A dummy callback which simply unlocks the oled lock. Lock is released */
+/* on error too, so failed command batch does not hang the caller	 */
+static void OLED_cbk_unlock(void *args, OLED_err err)
 {
-	if ((x >= oled->width) || (y >= oled->height))
-		return OLED_EBOUNDS;
-	OLED_put_pixel_(oled, x, y, pixel_state);	/* Use inline */
-	return OLED_EOK;
+	(void)err;
+	OLED *oled = args;
+	OLED_unlock(oled);
 }
 
 
-/**************************************************************************/
-/*!
-   @brief   Draw a rounded rectangle with no fill color
-    @param    oled     Display data struct 
-    @param    x_from   Top left corner x coordinate
-    @param    y_from   Top left corner y coordinate
-    @param    x_to     Width in pixels
-    @param    y_to     Height in pixels
-    @param    r        Radius of corner rounding
-    @param    params   Color and fill
-*/
-/**************************************************************************/
-OLED_err OLED_put_roundRect(OLED* oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, uint8_t r, enum OLED_params params)
-{
-
-    if (params > (OLED_BLACK | OLED_FILL))
-        return OLED_EPARAMS;
-    bool pixel_color = (OLED_BLACK & params) != 0;
-    bool is_fill = (OLED_FILL & params) != 0;
-
-    /* Limit coordinates to display bounds */
-    uint8_t size_errors = 0;
-    uint8_t w_max = oled->width - 1;
-    uint8_t h_max = oled->height - 1;
-    if (x_from > w_max) {
-        x_from = w_max;
-        size_errors++;
-    }
-    if (x_to > w_max) {
-        x_to = w_max;
-        size_errors++;
-    }
-    if (y_from > h_max) {
-        y_from = h_max;
-        size_errors++;
-    }
-    if (y_to > h_max) {
-        y_to = h_max;
-        size_errors++;
-    }
-    /* If all coordinates are out of bounds */
-    if (size_errors >= 4)
-        return OLED_EBOUNDS;
-
-    //OLED_WITH_SPINLOCK(oled) {
-    /* Normalize coordinates */
-    /* start_@ indicates coordinates of upper left corner  */
-    /* stop_@ indicates coordinates of bottom right corner */
-    uint8_t start_x = x_from; /* x min */
-    uint8_t start_y = y_from;
-    uint8_t stop_x = x_to; /* x max */
-    uint8_t stop_y = y_to; /* y max */
-
-    if (is_fill) {
-        /* Fill whole area */
-        for (uint8_t x = start_x + r; x <= stop_x + r; x++) {
-            for (uint8_t y = start_y; y <= stop_y + 2 * r; y++) {
-                OLED_put_pixel_(oled, x, y, pixel_color);
-            }
-        }
-        fillCircleHelper(oled, start_x + stop_x - r - 1, start_y + r, r, 1, stop_y - 2 * r - 1, pixel_color);
-        fillCircleHelper(oled, start_x + r, start_y + r, r, 2, stop_y - 2 * r - 1, pixel_color);
-    }
-    else {
-        /* Draw outer frame */
-        for (uint8_t x = start_x; x <= stop_x; x++) {
-            OLED_put_pixel_(oled, x + r, start_y, pixel_color);
-            OLED_put_pixel_(oled, x + r, stop_y + r * 2, pixel_color);
-        }
-        for (uint8_t y = start_y; y <= stop_y; y++) {
-            OLED_put_pixel_(oled, start_x, y + r, pixel_color);
-            OLED_put_pixel_(oled, stop_x + 2 * r, y + r, pixel_color);
-        }
-
-        drawCircleHelper(oled, x_from + r, start_y + r, r, 1, pixel_color);
-        drawCircleHelper(oled, start_x + stop_x - r - 1, start_y + r, r, 2, pixel_color);
-        drawCircleHelper(oled, start_x + stop_x - r - 1, start_y + stop_y - r - 1, r, 4, pixel_color);
-        drawCircleHelper(oled, start_x + r, start_y + stop_y - r - 1, r, 8, pixel_color);
-    }
-
-    return OLED_EOK;
-}
-/**************************************************************************/
-/*!
-   @brief    Quarter-circle drawer, used to do circles and roundrects
-    @param    oled     		 Display data struct
-    @param    x0  			 Center-point x coordinate
-    @param    y0   			 Center-point y coordinate
-    @param    r   			 Radius of circle
-    @param    cornername  	 Mask bit #1 or bit #2 to indicate which quarters of the circle we're doing
-    @param    params         Color and fill
-*/
-/**************************************************************************/
-OLED_err drawCircleHelper(OLED* oled, int16_t x0, int16_t y0, int16_t r, uint8_t cornername, enum OLED_params params)
-{
-
-    if (params > (OLED_BLACK | OLED_FILL))
-        return OLED_EPARAMS;
-    bool pixel_color = (OLED_BLACK & params) != 0;
-
-    int16_t f = 1 - r;
-    int16_t ddF_x = 1;
-    int16_t ddF_y = -2 * r;
-    int16_t x = 0;
-    int16_t y = r;
-
-    while (x < y) {
-        if (f >= 0) {
-            y--;
-            ddF_y += 2;
-            f += ddF_y;
-        }
-        x++;
-        ddF_x += 2;
-        f += ddF_x;
-        if (cornername & 0x4) {
-            OLED_put_pixel_(oled, x0 + x, y0 + y, pixel_color);
-            OLED_put_pixel_(oled, x0 + y, y0 + x, pixel_color);
-        }
-        if (cornername & 0x2) {
-            OLED_put_pixel_(oled, x0 + x, y0 - y, pixel_color);
-            OLED_put_pixel_(oled, x0 + y, y0 - x, pixel_color);
-        }
-        if (cornername & 0x8) {
-            OLED_put_pixel_(oled, x0 - y, y0 + x, pixel_color);
-            OLED_put_pixel_(oled, x0 - x, y0 + y, pixel_color);
-        }
-        if (cornername & 0x1) {
-            OLED_put_pixel_(oled, x0 - y, y0 - x, pixel_color);
-            OLED_put_pixel_(oled, x0 - x, y0 - y, pixel_color);
-        }
-    }
-    return OLED_EOK;
-}
-/**************************************************************************/
-/*!
-   @brief    Quarter-circle drawer with fill, used to do circles and roundrects
-    @param    oled          Display data struct
-    @param    x0   			Center-point x coordinate
-    @param    y0  		    Center-point y coordinate
-    @param    r   			Radius of circle
-    @param    cornername  	Mask bit #1 or bit #2 to indicate which quarters of the circle we're doing
-    @param    delta  		Offset from center-point, used for round-rects
-    @param    params  		Color and fill
-*/
-/**************************************************************************/
-OLED_err fillCircleHelper(OLED* oled, int16_t x0, int16_t y0, int16_t r, uint8_t cornername, int16_t delta, enum OLED_params params)
-{
-
-    if (params > (OLED_BLACK | OLED_FILL))
-        return OLED_EPARAMS;
-    bool pixel_color = (OLED_BLACK & params) != 0;
-
-    int16_t f = 1 - r;
-    int16_t ddF_x = 1;
-    int16_t ddF_y = -2 * r;
-    int16_t x = 0;
-    int16_t y = r;
-
-    while (x < y) {
-        if (f >= 0) {
-            y--;
-            ddF_y += 2;
-            f += ddF_y;
-        }
-        x++;
-        ddF_x += 2;
-        f += ddF_x;
-
-        if (cornername & 0x1) {
-            OLED_put_line(oled, x0 + x, y0 - y, x0 + x, y0 - y + (2 * y + 1 + delta) - 1, OLED_FILL | params);
-            OLED_put_line(oled, x0 + y, y0 - x, x0 + y, y0 - x + (2 * x + 1 + delta) - 1, OLED_FILL | params);
-        }
-        if (cornername & 0x2) {
-            OLED_put_line(oled, x0 - x, y0 - y, x0 - x, y0 - y + (2 * y + 1 + delta) - 1, OLED_FILL | params);
-            OLED_put_line(oled, x0 - y, y0 - x, x0 - y, y0 - x + (2 * x + 1 + delta) - 1, OLED_FILL | params);
-        }
-    }
-    return OLED_EOK;
+/* Finishes refresh: unlocks and calls user completion callback if provided */
+/* Ring scroll start line is sent here, when exposed rows are already sent */
+static void OLED_cbk_refreshdone(void *args, OLED_err err)
+{
+	OLED *oled = args;
+	if ((OLED_EOK == err) && oled->is_startline_dirty) {
+		oled->is_startline_dirty = false;
+		uint8_t *cmd = oled->cmdbuffer;
+		cmd[0] = 0x00;			/* Stream of commands follows	*/
+		cmd[1] = 0x40 | oled->start_line;
+		if (OLED_EOK == OLED_tx_next_(oled, cmd, 2, NULL, 0, &OLED_cbk_refreshdone, false))
+			return;
+		oled->is_startline_dirty = true;
+		err = OLED_EBUSY;
+	}
+	void (*end_cbk)(void *, OLED_err) = oled->refresh_cbk;
+	void *cbk_args = oled->refresh_cbk_args;
+	if (OLED_EOK != err)
+		oled->is_fullwin = false;	/* Window state is unknown */
+	OLED_unlock(oled);
+	if (NULL != end_cbk)
+		(*end_cbk)(cbk_args, err);
 }
 
 
-OLED_err OLED_put_rectangle(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, enum OLED_params params)
+/* Sends bytes to columns [x_from..x_to] of pages [page_from..page_to]. In   */
+/* horizontal addressing mode pointer runs through window columns and wraps */
+/* to the next page, so any window is one stream. Window commands go in the */
+/* same transaction, so there is no gap between them and the data. They    */
+/* are built in oled's cmdbuffer, which is free while refresh holds the	    */
+/* lock. Setting window and its data twice is harmless, so it is retried    */
+static OLED_err OLED_writewindow_(OLED *oled, uint8_t x_from, uint8_t x_to, uint8_t page_from,
+				  uint8_t page_to, uint8_t *bytes, uint16_t len,
+				  void (*end_cbk)(void *, OLED_err))
 {
-	if (params > (OLED_BLACK | OLED_FILL))
-		return OLED_EPARAMS;
-	bool pixel_color = (OLED_BLACK & params) != 0;
-	bool is_fill = (OLED_FILL & params) != 0;
-
-	/* Limit coordinates to display bounds */
-	uint8_t size_errors = 0;
-	uint8_t w_max = oled->width - 1;
-	uint8_t h_max = oled->height - 1;
-	if (x_from > w_max) {
-		x_from = w_max;
-		size_errors++;
-	}
-	if (x_to > w_max) {
-		x_to = w_max;
-		size_errors++;
+	/* Column range [start..end], page range [start..end] */
+	const uint8_t win[] = {0x21, x_from, x_to, 0x22, page_from, page_to};
+	uint8_t *cmd = oled->cmdbuffer;
+	uint8_t cmd_len = 0;
+#if defined(OLED_SPI)
+	cmd[cmd_len++] = 0x00;		/* Commands, then data with D/C# high */
+	for (uint8_t i = 0; i < sizeof win; i++)
+		cmd[cmd_len++] = win[i];
+#else
+	for (uint8_t i = 0; i < sizeof win; i++) {
+		cmd[cmd_len++] = 0x80;	/* Single command byte follows	*/
+		cmd[cmd_len++] = win[i];
 	}
-	if (y_from > h_max) {
-		y_from = h_max;
-		size_errors++;
-	}
-	if (y_to > h_max) {
-		y_to = h_max;
-		size_errors++;
+	cmd[cmd_len++] = 0x40;		/* Stream of data follows	*/
+#endif
+	return OLED_tx_next_(oled, cmd, cmd_len, bytes, len, end_cbk, false);
+}
+
+
+/* Sends bytes from the current position of pointer if window covers the    */
+/* whole display. Otherwise sets such window first			    */
+static OLED_err OLED_writefullwin_(OLED *oled, uint8_t *bytes, uint16_t len,
+				   void (*end_cbk)(void *, OLED_err))
+{
+	if (oled->is_fullwin) {
+		/* Pointer position matters, so data alone is not retried */
+		return OLED_tx_next_(oled, _i2c_cmd_dataprefix, OLED_ARR_SIZE(_i2c_cmd_dataprefix),
+				     bytes, len, end_cbk, true);
 	}
-	/* If all coordinates are out of bounds */
-	if (size_errors >= 4)
-		return OLED_EBOUNDS;
+	/* Refresh done callback resets it on errors */
+	oled->is_fullwin = true;
+	return OLED_writewindow_(oled, 0, OLED_WIDTH(oled) - 1, 0, OLED_PAGES(oled) - 1,
+			  bytes, len, end_cbk);
+}
 
-	//OLED_WITH_SPINLOCK(oled) {
+
+/* Pages of frame sent by one transaction of full refresh. I2C bus may be    */
+/* shared with other devices (see OLED_i2c_read), so each page is a separate */
+/* transaction they could get the bus after. SPI sends the whole frame	     */
+#if defined(OLED_SPI)
+	#define OLED_FRAME_CHUNK_PAGES(oled) OLED_PAGES(oled)
+#else
+	#define OLED_FRAME_CHUNK_PAGES(oled) 1
+#endif
+
+
+/* Sends the next chunk of tx_buffer as data, chaining itself as callback */
+static void OLED_cbk_writeframe(void *args, OLED_err err)
+{
+	OLED *oled = args;
+	if ((OLED_EOK != err) || (oled->cur_page >= OLED_PAGES(oled))) {
+		OLED_cbk_refreshdone(oled, err);
+		return;
+	}
+	uint8_t pages = OLED_FRAME_CHUNK_PAGES(oled);
+	uint8_t *bytes = &oled->tx_buffer[oled->cur_page * (uint16_t)OLED_WIDTH(oled)];
+	oled->cur_page += pages;
+	err = OLED_writefullwin_(oled, bytes, pages * (uint16_t)OLED_WIDTH(oled), &OLED_cbk_writeframe);
+	if (OLED_EOK != err)
+		OLED_cbk_refreshdone(oled, err);
+}
+
+
+/* Renders the next page and sends it as data */
+static void OLED_cbk_renderframe(void *args, OLED_err err)
+{
+	OLED *oled = args;
+	if (OLED_EOK != err) {
+		OLED_cbk_refreshdone(oled, err);
+		return;
+	}
+	if (oled->cur_page >= OLED_PAGES(oled)) {
+		OLED_cbk_refreshdone(oled, OLED_EOK);
+		return;
+	}
+	(*oled->render_cbk)(oled->render_cbk_args, oled->cur_page, oled->render_buffer);
+	oled->cur_page++;
+	err = OLED_writefullwin_(oled, oled->render_buffer, OLED_WIDTH(oled), &OLED_cbk_renderframe);
+	if (OLED_EOK != err)
+		OLED_cbk_refreshdone(oled, err);
+}
+
+
+/* Finds next page to be sent and writes its dirty span, chaining itself    */
+/* as callback. Unlocks when no pages are left or the previous page failed  */
+static void OLED_cbk_writepage(void *args, OLED_err err)
+{
+	OLED *oled = args;
+	if (OLED_EOK != err) {
+		OLED_cbk_refreshdone(oled, err);
+		return;
+	}
+	while ((oled->cur_page < OLED_PAGES(oled)) && !(oled->tx_pages & (1 << oled->cur_page)))
+		oled->cur_page++;
+	if (oled->cur_page >= OLED_PAGES(oled)) {
+		OLED_cbk_refreshdone(oled, OLED_EOK);
+		return;
+	}
+	uint8_t page = oled->cur_page;
+	oled->tx_pages &= ~(1 << page);
+	oled->is_fullwin = false;
+	uint8_t *lineptr;
+	if (NULL != oled->render_cbk) {
+		(*oled->render_cbk)(oled->render_cbk_args, page, oled->render_buffer);
+		lineptr = &oled->render_buffer[oled->tx_from[page]];
+	} else {
+		lineptr = &oled->tx_buffer[page * (uint16_t)OLED_WIDTH(oled) + oled->tx_from[page]];
+	}
+	uint16_t len = oled->tx_to[page] - oled->tx_from[page] + 1;
+	oled->cur_page++;
+	err = OLED_writewindow_(oled, oled->tx_from[page], oled->tx_to[page], page, page,
+				lineptr, len, &OLED_cbk_writepage);
+	if (OLED_EOK != err)
+		OLED_cbk_refreshdone(oled, err);
+}
+
+
+
+void OLED_cmd_begin(OLED *oled)
+{
+	OLED_spinlock(oled);
+	/* Code below is executed under lock, until batch is flushed */
+	oled->cmdbuffer[0] = 0x00;	/* Stream of commands follows */
+	oled->cmdbuffer_len = 1;
+}
+
+
+OLED_err OLED_cmd_append(OLED *oled, const uint8_t *cmds, uint8_t len)
+{
+	if (len > OLED_CMDBUFFER_LEN - oled->cmdbuffer_len)
+		return OLED_EBOUNDS;
+	memcpy(&oled->cmdbuffer[oled->cmdbuffer_len], cmds, len);
+	oled->cmdbuffer_len += len;
+	return OLED_EOK;
+}
+
+
+void OLED_cmd_flush(OLED *oled)
+{
+	if (oled->cmdbuffer_len <= 1) {
+		/* Nothing was added */
+		OLED_unlock(oled);
+		return;
+	}
+	/* Commands used by lib are idempotent, so batch is retried on errors */
+	while(!OLED_tx_shed(oled->i2c_addr, oled->cmdbuffer, oled->cmdbuffer_len, NULL, 0,
+				&OLED_cbk_unlock, oled, false)) {
+		// nop
+	}
+	/* Lock is unlocked when batch is sent */
+}
+
+
+void OLED_cmd_setbrightness(OLED *oled, uint8_t level)
+{
+	OLED_cmd_begin(oled);
+	OLED_CMDS(oled, 0x81, level);
+	OLED_cmd_flush(oled);
+}
+
+
+void OLED_cmd_scroll(OLED *oled, enum OLED_scroll_dir dir, uint8_t page_from, uint8_t page_to,
+		     enum OLED_scroll_interval interval, uint8_t v_offset)
+{
+	OLED_cmd_begin(oled);
+	/* Scroll must be stopped before it is reconfigured */
+	OLED_CMDS(oled, 0x2E);
+	if (v_offset) {
+		/* 0x29 and 0x2A are vertical and right or left */
+		OLED_CMDS(oled, 0xA3, 0, OLED_HEIGHT(oled),
+			  dir + 3, 0x00, page_from, interval, page_to, v_offset);
+	} else {
+		OLED_CMDS(oled, dir, 0x00, page_from, interval, page_to, 0x00, 0xFF);
+	}
+	OLED_CMDS(oled, 0x2F);
+	OLED_cmd_flush(oled);
+}
+
+
+void OLED_cmd_scroll_stop(OLED *oled)
+{
+	OLED_cmd_begin(oled);
+	OLED_CMDS(oled, 0x2E);
+	OLED_mark_dirty_(oled, 0, OLED_WIDTH(oled) - 1, 0, OLED_PAGES(oled) - 1);
+	OLED_cmd_flush(oled);
+}
+
+
+void OLED_cmd_setstartline(OLED *oled, uint8_t line)
+{
+	OLED_cmd_begin(oled);
+	oled->start_line = line & 0x3F;
+	OLED_CMDS(oled, 0x40 | oled->start_line);
+	OLED_cmd_flush(oled);
+}
+
+
+static void OLED_fill_area_(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to,
+			    uint8_t pixel_state);
+
+OLED_err OLED_ring_scroll(OLED *oled, uint8_t rows, bool pixel_state)
+{
+	uint8_t width = OLED_WIDTH(oled);
+	uint8_t height = OLED_HEIGHT(oled);
+	if ((8 * OLED_MAX_PAGES != height) || (rows > height))
+		return OLED_EPARAMS;
+	if (!rows)
+		return OLED_EOK;
+	/* Rows which were at the top become the bottom ones. Clip does not */
+	/* apply, as they are not where draw routines see them		    */
+	uint8_t from = oled->start_line;
+	uint8_t to = from + rows - 1;
+	if (to < height) {
+		OLED_fill_area_(oled, 0, from, width - 1, to, pixel_state);
+	} else {
+		OLED_fill_area_(oled, 0, from, width - 1, height - 1, pixel_state);
+		OLED_fill_area_(oled, 0, 0, width - 1, to - height, pixel_state);
+	}
+	oled->start_line = (from + rows) & (height - 1);
+	oled->is_startline_dirty = true;
+	return OLED_EOK;
+}
+
+
+/* Takes snapshot of dirty regions for the page callbacks and hands buffer   */
+/* being drawn to them. In double-buffered mode buffers are swapped and the  */
+/* dirty spans are copied, so drawing continues into up to date back buffer  */
+/* while front one is streamed. Must be called under lock		     */
+static void OLED_refresh_prepare(OLED *oled)
+{
+	uint8_t pages = oled->dirty_pages;
+	oled->tx_pages = pages;
+	oled->dirty_pages = 0;
+	memcpy(oled->tx_from, oled->dirty_from, sizeof oled->tx_from);
+	memcpy(oled->tx_to, oled->dirty_to, sizeof oled->tx_to);
+
+	uint8_t *front = oled->frame_buffer;
+	if ((oled->tx_buffer == front) || (NULL != oled->render_cbk))
+		return;		/* Single-buffered or bufferless */
+	/* Back buffer holds previous frame. It differs only in dirty spans */
+	uint8_t *back = oled->tx_buffer;
+	for (uint8_t page = 0; page < OLED_PAGES(oled); page++) {
+		if (!(pages & (1 << page)))
+			continue;
+		uint16_t offset = page * (uint16_t)OLED_WIDTH(oled) + oled->tx_from[page];
+		memcpy(&back[offset], &front[offset], oled->tx_to[page] - oled->tx_from[page] + 1);
+	}
+	oled->tx_buffer = front;
+	oled->frame_buffer = back;
+}
+
+
+OLED_err OLED_set_doublebuffer(OLED *oled, uint8_t *back_buffer)
+{
+	OLED_spinlock(oled);
+	if (NULL == back_buffer) {
+		/* Keep contents of what was drawn last */
+		if (oled->tx_buffer != oled->frame_buffer) {
+			memcpy(oled->tx_buffer, oled->frame_buffer,
+			       OLED_PAGES(oled) * (uint16_t)OLED_WIDTH(oled));
+			oled->frame_buffer = oled->tx_buffer;
+		}
+	} else {
+		if (back_buffer == oled->frame_buffer) {
+			OLED_unlock(oled);
+			return OLED_EPARAMS;
+		}
+		memcpy(back_buffer, oled->frame_buffer, OLED_PAGES(oled) * (uint16_t)OLED_WIDTH(oled));
+		oled->tx_buffer = back_buffer;
+	}
+	OLED_unlock(oled);
+	return OLED_EOK;
+}
+
+
+OLED_err OLED_set_render(OLED *oled, uint8_t *page_buffer, void (*render)(void *, uint8_t, uint8_t *), void *args)
+{
+	if ((NULL != render) && (NULL == page_buffer))
+		return OLED_EPARAMS;
+	OLED_spinlock(oled);
+	oled->render_cbk = render;
+	oled->render_cbk_args = args;
+	oled->render_buffer = page_buffer;
+	oled->dlist_buffer = NULL;
+	OLED_unlock(oled);
+	return OLED_EOK;
+}
+
+
+/* Starts full or dirty refresh. Must be called under lock */
+static void OLED_refresh_start(OLED *oled, bool only_dirty)
+{
+	OLED_refresh_prepare(oled);
+	oled->cur_page = 0;
+	OLED_PROFWRAP(
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			OLED_prof_data.refreshes++;
+			OLED_prof_data.pages += only_dirty ? __builtin_popcount(oled->tx_pages)
+							   : OLED_PAGES(oled);
+		}
+	)
+	if (only_dirty) {
+		OLED_cbk_writepage(oled, OLED_EOK);
+	} else if (NULL != oled->render_cbk) {
+		OLED_cbk_renderframe(oled, OLED_EOK);
+	} else {
+		/* Window is reset only if it was narrowed by dirty refresh.  */
+		/* Otherwise pointer has wrapped to origin after previous one */
+		OLED_cbk_writeframe(oled, OLED_EOK);
+	}
+	/* Lock is unlocked after series of callbacks, in the last one */
+}
+
+
+void OLED_refresh(OLED *oled)
+{
+	OLED_spinlock(oled);
+	/* Code below is executed under lock */
+	oled->refresh_cbk = NULL;
+	OLED_refresh_start(oled, false);
+}
+
+
+void OLED_refresh_dirty(OLED *oled)
+{
+	OLED_spinlock(oled);
+	oled->refresh_cbk = NULL;
+	OLED_refresh_start(oled, true);
+}
+
+
+OLED_err OLED_refresh_async(OLED *oled, bool only_dirty, void (*end_cbk)(void *, OLED_err), void *cbk_args)
+{
+	if (!OLED_trylock(oled))
+		return OLED_EBUSY;
+	oled->refresh_cbk = end_cbk;
+	oled->refresh_cbk_args = cbk_args;
+	OLED_refresh_start(oled, only_dirty);
+	return OLED_EOK;
+}
+
+
+/***** Refresh scheduler *****/
+/* Kinds of refresh pending, combined by OR. Full one takes over dirty */
+enum OLED_sched_e {
+	OLED_SCHED_DIRTY = 0x01,
+	OLED_SCHED_FULL = 0x02
+};
+
+
+/* Starts pending refresh if display is free and frame interval is over.     */
+/* Lock, pending kinds and interval are taken together, so that request and  */
+/* poll racing with the tick start it once. Called only from thread context: */
+/* refresh takes dirty spans and swaps buffers, which must not happen in the */
+/* middle of a draw routine interrupted by ISR				     */
+static void OLED_sched_kick_(OLED *oled)
+{
+	uint8_t pending = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (oled->refresh_pending && !oled->frame_wait && OLED_trylock(oled)) {
+			pending = oled->refresh_pending;
+			oled->refresh_pending = 0;
+			oled->frame_wait = oled->frame_ticks;
+		}
+	}
+	if (!pending)
+		return;
+	/* Code below is executed under lock */
+	oled->refresh_cbk = NULL;
+	OLED_refresh_start(oled, !(pending & OLED_SCHED_FULL));
+}
+
+
+void OLED_refresh_request(OLED *oled, bool only_dirty)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		oled->refresh_pending |= only_dirty ? OLED_SCHED_DIRTY : OLED_SCHED_FULL;
+	}
+	OLED_sched_kick_(oled);
+}
+
+
+void OLED_refresh_poll(OLED *oled)
+{
+	OLED_sched_kick_(oled);
+}
+
+
+void OLED_set_frame_ticks(OLED *oled, uint8_t ticks)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		oled->frame_ticks = ticks;
+		if (oled->frame_wait > ticks)
+			oled->frame_wait = ticks;
+	}
+}
+
+
+void OLED_refresh_tick(OLED *oled)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (oled->frame_wait)
+			oled->frame_wait--;
+	}
+}
+#endif // OLED_NO_I2C
+
+
+/***** Display-related logic *****/
+/* Clip rectangle and origin. Recorded in display list mode, so that records */
+/* which follow are rendered with the same ones				      */
+struct OLED_view_s {
+	uint8_t clip_x_from;
+	uint8_t clip_y_from;
+	uint8_t clip_x_to;
+	uint8_t clip_y_to;
+	uint8_t origin_x;
+	uint8_t origin_y;
+};
+
+#if !defined(OLED_NO_I2C)
+/* Arguments of display list records. See "Display list" below */
+enum OLED_dl_op_e {
+	OLED_DL_PIXEL = 0,
+	OLED_DL_RECT,
+	OLED_DL_LINE,
+	OLED_DL_BITMAP,
+	OLED_DL_BITMAP_P,
+	OLED_DL_TEXT,		/* String is copied after arguments */
+	OLED_DL_TEXT_P,
+	OLED_DL_CIRCLE,
+	OLED_DL_ELLIPSE,
+	OLED_DL_ROUNDRECT,
+	OLED_DL_RLE_P,		/* w and h are not used */
+	OLED_DL_VIEW		/* Applies to all pages, does not draw */
+};
+
+struct OLED_dl_shape_s {
+	uint8_t x_from;
+	uint8_t y_from;
+	uint8_t x_to;
+	uint8_t y_to;
+	uint8_t params;
+};
+
+struct OLED_dl_image_s {
+	const uint8_t *bitmap;
+	uint8_t x;
+	uint8_t y;
+	uint8_t w;
+	uint8_t h;
+	uint8_t params;
+};
+
+struct OLED_dl_ellipse_s {
+	int16_t x0;
+	int16_t y0;
+	uint8_t rx;
+	uint8_t ry;
+	uint8_t params;
+};
+
+struct OLED_dl_roundrect_s {
+	uint8_t x_from;
+	uint8_t y_from;
+	uint8_t x_to;
+	uint8_t y_to;
+	uint8_t r;
+	uint8_t params;
+};
+
+struct OLED_dl_text_s {
+	const OLED_font *font;
+	const char *str;	/* Only for PROGMEM strings */
+	uint8_t x;
+	uint8_t y;
+	uint8_t params;
+};
+
+
+static OLED_err OLED_dl_add_(OLED *oled, uint8_t op, const void *args, uint8_t args_len,
+			     const char *str, uint8_t str_len, uint8_t x_from, uint8_t y_from,
+			     uint8_t x_to, uint8_t y_to);
+static OLED_err OLED_dl_text_(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font,
+			      const char *str, bool is_progmem, enum OLED_params params);
+static OLED_err OLED_dl_view_(OLED *oled, const struct OLED_view_s *view);
+static void OLED_dl_restart_(OLED *oled, bool background);
+#endif
+static OLED_err OLED_put_ellipse_(OLED *oled, int16_t x0, int16_t y0, uint8_t rx, uint8_t ry,
+				  bool is_circle, enum OLED_params params);
+
+
+/* Box in display coordinates. Unlike arguments of draw routines, may lie */
+/* partially or fully outside of display				  */
+struct OLED_box_s {
+	int16_t x_from;
+	int16_t y_from;
+	int16_t x_to;
+	int16_t y_to;
+};
+
+
+/* Limits normalized box to clip rectangle. Returns false if nothing is left */
+static inline ALWAYSINLINE bool OLED_clip_box_(OLED *oled, struct OLED_box_s *box)
+{
+	if (box->x_from < oled->clip_x_from)
+		box->x_from = oled->clip_x_from;
+	if (box->y_from < oled->clip_y_from)
+		box->y_from = oled->clip_y_from;
+	if (box->x_to > oled->clip_x_to)
+		box->x_to = oled->clip_x_to;
+	if (box->y_to > oled->clip_y_to)
+		box->y_to = oled->clip_y_to;
+	return (box->x_from <= box->x_to) && (box->y_from <= box->y_to);
+}
+
+
+/* True if normalized box lies inside clip rectangle, so needs no checks */
+static inline ALWAYSINLINE bool OLED_is_inside_clip_(OLED *oled, const struct OLED_box_s *box)
+{
+	return (box->x_from >= oled->clip_x_from) && (box->x_to <= oled->clip_x_to)
+	       && (box->y_from >= oled->clip_y_from) && (box->y_to <= oled->clip_y_to);
+}
+
+
+/* State shared by displays and surfaces: no clip, no origin, nothing dirty */
+static void OLED_init_state_(OLED *oled, uint8_t width, uint8_t height, uint8_t *frame_buffer)
+{
+	oled->width = width;
+	oled->height = height;
+	oled->frame_buffer = frame_buffer;
+	oled->busy_lock = 1;	/* Initially: 1 - unlocked */
+	oled->clip_x_from = 0;
+	oled->clip_y_from = 0;
+	oled->clip_x_to = width - 1;
+	oled->clip_y_to = height - 1;
+	oled->origin_x = 0;
+	oled->origin_y = 0;
+
+	OLED_I2CWRAP(
+		oled->tx_buffer = frame_buffer;	/* Single-buffered by default */
+		oled->cur_page = 0;
+		oled->dirty_pages = 0;
+		oled->tx_pages = 0;
+		oled->is_fullwin = true;
+		oled->refresh_cbk = NULL;
+		oled->render_cbk = NULL;
+		oled->dlist_buffer = NULL;
+		oled->start_line = 0;
+		oled->is_startline_dirty = false;
+		oled->refresh_pending = 0;
+		oled->frame_ticks = 0;
+		oled->frame_wait = 0;
+	) // OLED_I2CWRAP
+}
+
+
+OLED_err __OLED_init(OLED *oled, uint8_t width, uint8_t height, uint8_t *frame_buffer, uint32_t i2c_freq_hz, uint8_t i2c_addr)
+{
+	OLED_init_state_(oled, width, height, frame_buffer);
+
+	OLED_I2CWRAP(
+		oled->i2c_addr = i2c_addr;
+		OLED_tx_init_(i2c_freq_hz);
+
+		OLED_cmd_begin(oled);
+		OLED_cmd_append(oled, _i2c_cmd_init, sizeof _i2c_cmd_init);
+		/* Multiplex ratio is number of rows. Panels up to 32 rows tall	*/
+		/* have sequential COM pins, taller ones have alternative	*/
+		OLED_CMDS(oled, 0xA8, height - 1, 0xDA, (height > 32) ? 0x12 : 0x02);
+		/* Address window covers whole display after init */
+		OLED_CMDS(oled, 0x21, 0, width - 1, 0x22, 0, OLED_PAGES(oled) - 1);
+		OLED_cmd_flush(oled);
+	) // OLED_I2CWRAP
+
+	return OLED_EOK;
+}
+
+
+#if !defined(OLED_FIXED_WIDTH)
+/***** Off-screen surfaces *****/
+void OLED_arena_init(OLED_arena *arena, uint8_t *buffer, uint16_t size)
+{
+	arena->next = buffer;
+	arena->left = size;
+}
+
+
+OLED_err OLED_surface_init(OLED *surface, uint8_t width, uint8_t height, OLED_arena *arena)
+{
+	if (!width || !height || (height % 8) || (height > 8 * OLED_MAX_PAGES))
+		return OLED_EPARAMS;
+	uint16_t size = OLED_FB_SIZE(width, height);
+	if (size > arena->left)
+		return OLED_EBOUNDS;
+	uint8_t *buffer = arena->next;
+	arena->next += size;
+	arena->left -= size;
+	memset(buffer, 0x00, size);
+	OLED_init_state_(surface, width, height, buffer);
+	return OLED_EOK;
+}
+#endif
+
+
+/* Pixel value for params: 0, 1 or OLED_XOR, which inverts pixels */
+static inline ALWAYSINLINE uint8_t OLED_pixel_op_(enum OLED_params params)
+{
+	return (params & OLED_XOR) ? OLED_XOR : (params & OLED_BLACK);
+}
+
+
+static inline ALWAYSINLINE void OLED_get_view_(OLED *oled, struct OLED_view_s *view)
+{
+	view->clip_x_from = oled->clip_x_from;
+	view->clip_y_from = oled->clip_y_from;
+	view->clip_x_to = oled->clip_x_to;
+	view->clip_y_to = oled->clip_y_to;
+	view->origin_x = oled->origin_x;
+	view->origin_y = oled->origin_y;
+}
+
+
+static inline ALWAYSINLINE void OLED_load_view_(OLED *oled, const struct OLED_view_s *view)
+{
+	oled->clip_x_from = view->clip_x_from;
+	oled->clip_y_from = view->clip_y_from;
+	oled->clip_x_to = view->clip_x_to;
+	oled->clip_y_to = view->clip_y_to;
+	oled->origin_x = view->origin_x;
+	oled->origin_y = view->origin_y;
+}
+
+
+/* Applies view. In display list mode it is recorded first, so it is left */
+/* unchanged if the list is full					  */
+static OLED_err OLED_set_view_(OLED *oled, const struct OLED_view_s *view)
+{
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer) {
+		OLED_err err = OLED_dl_view_(oled, view);
+		if (OLED_EOK != err)
+			return err;
+	}
+#endif
+	OLED_load_view_(oled, view);
+	return OLED_EOK;
+}
+
+
+/* Puts normalized rectangle, limited to display, to clip of view */
+static bool OLED_view_clip_(OLED *oled, struct OLED_view_s *view, uint8_t x_from, uint8_t y_from,
+			    uint8_t x_to, uint8_t y_to)
+{
+	(void)oled;	/* Unused if geometry is fixed */
+	uint8_t w_max = OLED_WIDTH(oled) - 1;
+	uint8_t h_max = OLED_HEIGHT(oled) - 1;
+	uint8_t start_x = x_to < x_from ? x_to : x_from;
+	uint8_t start_y = y_to < y_from ? y_to : y_from;
+	uint8_t stop_x = x_to > x_from ? x_to : x_from;
+	uint8_t stop_y = y_to > y_from ? y_to : y_from;
+	if ((start_x > w_max) || (start_y > h_max))
+		return false;
+	view->clip_x_from = start_x;
+	view->clip_y_from = start_y;
+	view->clip_x_to = stop_x > w_max ? w_max : stop_x;
+	view->clip_y_to = stop_y > h_max ? h_max : stop_y;
+	return true;
+}
+
+
+OLED_err OLED_set_clip(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to)
+{
+	struct OLED_view_s view;
+	OLED_get_view_(oled, &view);
+	if (!OLED_view_clip_(oled, &view, x_from, y_from, x_to, y_to))
+		return OLED_EBOUNDS;
+	return OLED_set_view_(oled, &view);
+}
+
+
+OLED_err OLED_set_origin(OLED *oled, uint8_t x, uint8_t y)
+{
+	struct OLED_view_s view;
+	OLED_get_view_(oled, &view);
+	view.origin_x = x;
+	view.origin_y = y;
+	return OLED_set_view_(oled, &view);
+}
+
+
+OLED_err OLED_set_viewport(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to)
+{
+	struct OLED_view_s view;
+	if (!OLED_view_clip_(oled, &view, x_from, y_from, x_to, y_to))
+		return OLED_EBOUNDS;
+	view.origin_x = view.clip_x_from;
+	view.origin_y = view.clip_y_from;
+	return OLED_set_view_(oled, &view);
+}
+
+
+OLED_err OLED_reset_viewport(OLED *oled)
+{
+	const struct OLED_view_s view = {0, 0, OLED_WIDTH(oled) - 1, OLED_HEIGHT(oled) - 1, 0, 0};
+	return OLED_set_view_(oled, &view);
+}
+
+
+OLED_err OLED_put_pixel(OLED *oled, uint8_t x, uint8_t y, uint8_t pixel_state)
+{
+	uint16_t disp_x = x + oled->origin_x;
+	uint16_t disp_y = y + oled->origin_y;
+	if ((disp_x < oled->clip_x_from) || (disp_x > oled->clip_x_to)
+	    || (disp_y < oled->clip_y_from) || (disp_y > oled->clip_y_to))
+		return OLED_EBOUNDS;
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer) {
+		const struct OLED_dl_shape_s rec = {x, y, x, y, pixel_state};
+		return OLED_dl_add_(oled, OLED_DL_PIXEL, &rec, sizeof rec, NULL, 0,
+				    disp_x, disp_y, disp_x, disp_y);
+	}
+#endif
+	OLED_put_pixel_(oled, disp_x, disp_y, pixel_state);	/* Use inline */
+	return OLED_EOK;
+}
+
+
+/* Applies mask to len consecutive page bytes: sets, clears or inverts	  */
+/* masked bits								  */
+static inline ALWAYSINLINE void OLED_mask_run_(uint8_t *ptr, uint8_t len, uint8_t mask, uint8_t pixel_state)
+{
+	if (OLED_XOR == pixel_state) {
+		while (len--)
+			*ptr++ ^= mask;
+	} else if (pixel_state) {
+		while (len--)
+			*ptr++ |= mask;
+	} else {
+		mask = ~mask;
+		while (len--)
+			*ptr++ &= mask;
+	}
+}
+
+
+/* Body of OLED_fill_span_. Area must be normalized and inside display */
+static void OLED_fill_area_(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to,
+			    uint8_t pixel_state)
+{
+	uint8_t page_from = y_from / 8;
+	uint8_t page_to = y_to / 8;
+	uint8_t len = x_to - x_from + 1;
+	/* Bits [y_from % 8 .. 7] of first page and [0 .. y_to % 8] of last */
+	uint8_t head_mask = (uint8_t)(0xFF << (y_from % 8));
+	uint8_t tail_mask = (uint8_t)(0xFF >> (7 - y_to % 8));
+	uint8_t *ptr = &oled->frame_buffer[page_from * (uint16_t)OLED_WIDTH(oled) + x_from];
+
+	OLED_mark_dirty_(oled, x_from, x_to, page_from, page_to);
+	OLED_PROFWRAP(OLED_prof_data.pixels += (uint16_t)len * (y_to - y_from + 1);)
+
+	for (uint8_t page = page_from; page <= page_to; page++, ptr += OLED_WIDTH(oled)) {
+		uint8_t mask = 0xFF;
+		if (page == page_from)
+			mask &= head_mask;
+		if (page == page_to)
+			mask &= tail_mask;
+
+		if ((0xFF == mask) && (OLED_XOR != pixel_state))
+			memset(ptr, pixel_state ? 0xFF : 0x00, len);
+		else
+			OLED_mask_run_(ptr, len, mask, pixel_state);
+	}
+}
+
+
+/* Fills normalized box in display coordinates, clipped once */
+static void OLED_fill_box_(OLED *oled, struct OLED_box_s box, uint8_t pixel_state)
+{
+	if (OLED_clip_box_(oled, &box))
+		OLED_fill_area_(oled, box.x_from, box.y_from, box.x_to, box.y_to, pixel_state);
+}
+
+
+void OLED_fill_span_(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, uint8_t pixel_state)
+{
+	const struct OLED_box_s box = {x_from, y_from, x_to, y_to};
+	OLED_fill_box_(oled, box, pixel_state);
+}
+
+
+void OLED_fill_screen(OLED *oled, bool pixel_state)
+{
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer) {
+		/* Scene starts over on the cleared screen */
+		OLED_dl_restart_(oled, pixel_state);
+		OLED_mark_dirty_(oled, 0, OLED_WIDTH(oled) - 1, 0, OLED_PAGES(oled) - 1);
+		return;
+	}
+#endif
+	memset(oled->frame_buffer, pixel_state ? 0xFF : 0x00, OLED_FB_SIZE(OLED_WIDTH(oled), OLED_HEIGHT(oled)));
+	OLED_PROFWRAP(OLED_prof_data.pixels += (uint16_t)OLED_WIDTH(oled) * OLED_HEIGHT(oled);)
+	OLED_mark_dirty_(oled, 0, OLED_WIDTH(oled) - 1, 0, OLED_PAGES(oled) - 1);
+}
+
+
+OLED_err OLED_put_rectangle(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, enum OLED_params params)
+{
+	if (params > (OLED_BLACK | OLED_FILL | OLED_XOR))
+		return OLED_EPARAMS;
+	uint8_t pixel_color = OLED_pixel_op_(params);
+	bool is_fill = (OLED_FILL & params) != 0;
+
+	//OLED_WITH_SPINLOCK(oled) {
 		/* Normalize coordinates */
 		/* start_@ indicates coordinates of upper left corner  */
 		/* stop_@ indicates coordinates of bottom right corner */
@@ -493,25 +1813,1058 @@ OLED_err OLED_put_rectangle(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t
 		uint8_t stop_x = x_to > x_from ? x_to : x_from;  /* x max */
 		uint8_t stop_y = y_to > y_from ? y_to : y_from;  /* y max */
 
+		/* Sides are clipped separately, so ones out of clip are not drawn */
+		const struct OLED_box_s rect = {
+			start_x + oled->origin_x, start_y + oled->origin_y,
+			stop_x + oled->origin_x, stop_y + oled->origin_y
+		};
+		struct OLED_box_s box = rect;
+		if (!OLED_clip_box_(oled, &box))
+			return OLED_EBOUNDS;
+
+#if !defined(OLED_NO_I2C)
+		if (NULL != oled->dlist_buffer) {
+			const struct OLED_dl_shape_s rec = {start_x, start_y, stop_x, stop_y, params};
+			return OLED_dl_add_(oled, OLED_DL_RECT, &rec, sizeof rec, NULL, 0,
+					    box.x_from, box.y_from, box.x_to, box.y_to);
+		}
+#endif
+
+		if (is_fill) {
+			/* Fill whole area */
+			OLED_fill_area_(oled, box.x_from, box.y_from, box.x_to, box.y_to, pixel_color);
+		} else {
+			/* Draw outer frame. Sides do not overlap, so XOR */
+			/* inverts corners once				  */
+			struct OLED_box_s side = rect;
+			side.y_to = rect.y_from;
+			OLED_fill_box_(oled, side, pixel_color);
+			if (rect.y_to != rect.y_from) {
+				side.y_from = side.y_to = rect.y_to;
+				OLED_fill_box_(oled, side, pixel_color);
+			}
+			if (rect.y_to - rect.y_from > 1) {
+				side = rect;
+				side.y_from++;
+				side.y_to--;
+				side.x_to = rect.x_from;
+				OLED_fill_box_(oled, side, pixel_color);
+				if (rect.x_to != rect.x_from) {
+					side.x_from = side.x_to = rect.x_to;
+					OLED_fill_box_(oled, side, pixel_color);
+				}
+			}
+		}
+	//}
+
+	return OLED_EOK;
+}
+
+
+OLED_err OLED_invert_region(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to)
+{
+	return OLED_put_rectangle(oled, x_from, y_from, x_to, y_to, OLED_FILL | OLED_XOR);
+}
+
+
+OLED_err OLED_put_line(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, enum OLED_params params)
+{
+	if (params > (OLED_BLACK | OLED_FILL | OLED_XOR))
+		return OLED_EPARAMS;
+	uint8_t pixel_color = OLED_pixel_op_(params);
+
+	int16_t x0 = x_from + oled->origin_x;
+	int16_t y0 = y_from + oled->origin_y;
+	int16_t x1 = x_to + oled->origin_x;
+	int16_t y1 = y_to + oled->origin_y;
+	struct OLED_box_s box = {
+		x1 < x0 ? x1 : x0, y1 < y0 ? y1 : y0,
+		x1 > x0 ? x1 : x0, y1 > y0 ? y1 : y0
+	};
+	bool is_checked = !OLED_is_inside_clip_(oled, &box);
+	if (!OLED_clip_box_(oled, &box))
+		return OLED_EBOUNDS;
+
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer) {
+		const struct OLED_dl_shape_s rec = {x_from, y_from, x_to, y_to, params};
+		return OLED_dl_add_(oled, OLED_DL_LINE, &rec, sizeof rec, NULL, 0,
+				    box.x_from, box.y_from, box.x_to, box.y_to);
+	}
+#endif
+
+	/* Fast paths. Clipped box is the visible part of the line */
+	if ((x0 == x1) || (y0 == y1)) {
+		OLED_fill_area_(oled, box.x_from, box.y_from, box.x_to, box.y_to, pixel_color);
+		return OLED_EOK;
+	}
+
+	/* Bresenham. Works in all octants using signed steps */
+	int16_t dx = (x1 > x0) ? (x1 - x0) : (x0 - x1);
+	int16_t dy = (y1 > y0) ? (y0 - y1) : (y1 - y0);	/* -abs */
+	int8_t step_x = (x1 > x0) ? 1 : -1;
+	int8_t step_y = (y1 > y0) ? 1 : -1;
+	int16_t err = dx + dy;
+	int16_t x = x0;
+	int16_t y = y0;
+	bool was_inside = false;
+	/* Line steps are monotonic, so the first and the last drawn pixels  */
+	/* span what is drawn. Box may cross clip while the line misses it   */
+	int16_t first_x = x0, first_y = y0;
+	int16_t last_x = x0, last_y = y0;
+
+	while (true) {
+		if (!is_checked || ((x >= box.x_from) && (x <= box.x_to)
+				    && (y >= box.y_from) && (y <= box.y_to))) {
+			OLED_fb_pixel_(oled, x, y, pixel_color);
+			if (!was_inside) {
+				first_x = x;
+				first_y = y;
+			}
+			last_x = x;
+			last_y = y;
+			was_inside = true;
+		} else if (was_inside) {
+			break;	/* Clip is convex, line does not come back */
+		}
+		if ((x == x1) && (y == y1))
+			break;
+		int16_t err2 = 2 * err;
+		if (err2 >= dy) {
+			err += dy;
+			x += step_x;
+		}
+		if (err2 <= dx) {
+			err += dx;
+			y += step_y;
+		}
+	}
+
+	/* Mark drawn part at once */
+	if (was_inside) {
+		uint8_t y_min = (first_y < last_y) ? first_y : last_y;
+		uint8_t y_max = (first_y < last_y) ? last_y : first_y;
+		OLED_mark_dirty_(oled, (first_x < last_x) ? first_x : last_x,
+				 (first_x < last_x) ? last_x : first_x, y_min / 8, y_max / 8);
+	}
+	return OLED_EOK;
+}
+
+
+/***** Circles and ellipses *****/
+/* Sets, clears or inverts rows [y_from..y_to] of column x, one masked byte */
+/* per page. No checks and no dirty tracking				     */
+static void OLED_vspan_(OLED *oled, uint8_t x, uint8_t y_from, uint8_t y_to, uint8_t pixel_state)
+{
+	uint8_t page = y_from / 8;
+	uint8_t page_to = y_to / 8;
+	uint8_t *ptr = &oled->frame_buffer[page * (uint16_t)OLED_WIDTH(oled) + x];
+	uint8_t mask = (uint8_t)(0xFF << (y_from % 8));
+	OLED_PROFWRAP(OLED_prof_data.pixels += y_to - y_from + 1;)
+	for (;; page++, ptr += OLED_WIDTH(oled)) {
+		if (page == page_to)
+			mask &= (uint8_t)(0xFF >> (7 - y_to % 8));
+		if (OLED_XOR == pixel_state)
+			*ptr ^= mask;
+		else if (pixel_state)
+			*ptr |= mask;
+		else
+			*ptr &= ~mask;
+		if (page == page_to)
+			break;
+		mask = 0xFF;
+	}
+}
+
+
+/* Centers of corner arcs. Rounded rectangle has quarters of the circle    */
+/* moved apart to its corners, circle and ellipse have all of them at	    */
+/* the center								    */
+struct OLED_arcs_s {
+	int16_t x_l;
+	int16_t y_t;
+	int16_t x_r;
+	int16_t y_b;
+};
+
+
+/* Fills column dx of arcs, i.e. columns x_l - dx and x_r + dx from y_t - h */
+/* to y_b + h. Column 0 is the whole block between arc centers. Each column */
+/* is clipped once, then drawn by page bytes				    */
+static void OLED_arcs_cols_(OLED *oled, const struct OLED_arcs_s *arcs, int16_t dx, int16_t h,
+			    uint8_t pixel_state)
+{
+	int16_t y_from = arcs->y_t - h;
+	int16_t y_to = arcs->y_b + h;
+	if (y_from < oled->clip_y_from)
+		y_from = oled->clip_y_from;
+	if (y_to > oled->clip_y_to)
+		y_to = oled->clip_y_to;
+	if (y_from > y_to)
+		return;
+	int16_t x_l = arcs->x_l - dx;
+	int16_t x_r = arcs->x_r + dx;
+	if (!dx) {
+		if (x_l < oled->clip_x_from)
+			x_l = oled->clip_x_from;
+		if (x_r > oled->clip_x_to)
+			x_r = oled->clip_x_to;
+		if (x_l == x_r)
+			OLED_vspan_(oled, x_l, y_from, y_to, pixel_state);
+		else if (x_l < x_r)
+			OLED_fill_area_(oled, x_l, y_from, x_r, y_to, pixel_state);
+		return;
+	}
+	if ((x_r >= oled->clip_x_from) && (x_r <= oled->clip_x_to))
+		OLED_vspan_(oled, x_r, y_from, y_to, pixel_state);
+	if ((x_l >= oled->clip_x_from) && (x_l <= oled->clip_x_to))
+		OLED_vspan_(oled, x_l, y_from, y_to, pixel_state);
+}
+
+
+/* Puts pixel if it is visible. Checks are skipped for shapes inside bounds */
+static inline ALWAYSINLINE void OLED_arcs_pixel_(OLED *oled, int16_t x, int16_t y,
+						 bool is_checked, uint8_t pixel_state)
+{
+	if (is_checked && ((x < oled->clip_x_from) || (x > oled->clip_x_to)
+			   || (y < oled->clip_y_from) || (y > oled->clip_y_to)))
+		return;
+	OLED_fb_pixel_(oled, x, y, pixel_state);
+}
+
+
+/* Puts point (dx, dy) of each of the four arcs, coinciding ones once */
+static void OLED_arcs_points_(OLED *oled, const struct OLED_arcs_s *arcs, int16_t dx, int16_t dy,
+			      bool is_checked, uint8_t pixel_state)
+{
+	bool has_left = dx || (arcs->x_l != arcs->x_r);
+	bool has_top = dy || (arcs->y_t != arcs->y_b);
+	OLED_arcs_pixel_(oled, arcs->x_r + dx, arcs->y_b + dy, is_checked, pixel_state);
+	if (has_left)
+		OLED_arcs_pixel_(oled, arcs->x_l - dx, arcs->y_b + dy, is_checked, pixel_state);
+	if (has_top)
+		OLED_arcs_pixel_(oled, arcs->x_r + dx, arcs->y_t - dy, is_checked, pixel_state);
+	if (has_left && has_top)
+		OLED_arcs_pixel_(oled, arcs->x_l - dx, arcs->y_t - dy, is_checked, pixel_state);
+}
+
+
+/* Midpoint circle. Walks the octant from (0, r) while x <= y, mirroring   */
+/* points to the others. Fill emits column x with half-height y on each    */
+/* step and column y with half-height x right before y decreases, so each  */
+/* column is drawn exactly once						   */
+static void OLED_circle_(OLED *oled, const struct OLED_arcs_s *arcs, int16_t r, bool is_fill,
+			 bool is_checked, uint8_t pixel_state)
+{
+	int16_t x = 0;
+	int16_t y = r;
+	int16_t f = 1 - r;
+	while (x <= y) {
 		if (is_fill) {
-			/* Fill whole area */
-			for (uint8_t x = start_x; x <= stop_x; x++) {
-				for (uint8_t y = start_y; y <= stop_y; y++) {
-					OLED_put_pixel_(oled, x, y, pixel_color);
-				}
+			OLED_arcs_cols_(oled, arcs, x, y, pixel_state);
+		} else {
+			OLED_arcs_points_(oled, arcs, x, y, is_checked, pixel_state);
+			if (x != y)
+				OLED_arcs_points_(oled, arcs, y, x, is_checked, pixel_state);
+		}
+		if (f < 0) {
+			f += 2 * x + 3;
+		} else {
+			if (is_fill && (x != y))
+				OLED_arcs_cols_(oled, arcs, y, x, pixel_state);
+			f += 2 * (x - y) + 5;
+			y--;
+		}
+		x++;
+	}
+}
+
+
+/* Midpoint ellipse, walking the quadrant from (0, ry) to (rx, 0). In the   */
+/* first region x grows on each step, in the second one y decreases. Fill   */
+/* emits column only for the first point with new x, which is the tallest   */
+static void OLED_ellipse_(OLED *oled, const struct OLED_arcs_s *arcs, int16_t rx, int16_t ry,
+			  bool is_fill, bool is_checked, uint8_t pixel_state)
+{
+	int32_t rx2 = (int32_t)rx * rx;
+	int32_t ry2 = (int32_t)ry * ry;
+	int16_t x = 0;
+	int16_t y = ry;
+	int32_t px = 0;
+	int32_t py = 2 * rx2 * y;
+
+	int32_t p = ry2 - rx2 * ry + rx2 / 4;
+	while (px < py) {
+		if (is_fill)
+			OLED_arcs_cols_(oled, arcs, x, y, pixel_state);
+		else
+			OLED_arcs_points_(oled, arcs, x, y, is_checked, pixel_state);
+		x++;
+		px += 2 * ry2;
+		if (p < 0) {
+			p += ry2 + px;
+		} else {
+			y--;
+			py -= 2 * rx2;
+			p += ry2 + px - py;
+		}
+	}
+
+	int16_t x_drawn = x - 1;
+	p = (ry2 * (2 * x + 1) * (2 * x + 1)) / 4 + rx2 * (y - 1) * (y - 1) - rx2 * ry2;
+	while (y >= 0) {
+		if (!y) {
+			/* Thin ellipse gets to the axis before rx, so the rest is a */
+			/* run along it. Never past rx, which is the bounding box   */
+			if (x > rx)
+				x = rx;
+			for (; x <= rx; x++) {
+				if (!is_fill)
+					OLED_arcs_points_(oled, arcs, x, 0, is_checked, pixel_state);
+				else if (x != x_drawn)
+					OLED_arcs_cols_(oled, arcs, x, 0, pixel_state);
 			}
+			break;
+		}
+		if (!is_fill)
+			OLED_arcs_points_(oled, arcs, x, y, is_checked, pixel_state);
+		else if (x != x_drawn)
+			OLED_arcs_cols_(oled, arcs, x, y, pixel_state);
+		x_drawn = x;
+		y--;
+		py -= 2 * rx2;
+		if (p > 0) {
+			p += rx2 - py;
 		} else {
-			/* Draw outer frame */
-			for (uint8_t x = start_x; x <= stop_x; x++) {
-				OLED_put_pixel_(oled, x, start_y, pixel_color);
-				OLED_put_pixel_(oled, x, stop_y, pixel_color);
+			x++;
+			px += 2 * ry2;
+			p += rx2 - py + px;
+		}
+	}
+}
+
+
+static OLED_err OLED_put_ellipse_(OLED *oled, int16_t x0, int16_t y0, uint8_t rx, uint8_t ry,
+				  bool is_circle, enum OLED_params params)
+{
+	if (params > (OLED_BLACK | OLED_FILL | OLED_XOR))
+		return OLED_EPARAMS;
+	uint8_t pixel_color = OLED_pixel_op_(params);
+	bool is_fill = (OLED_FILL & params) != 0;
+
+	/* Bounding box, clipped once */
+	int16_t disp_x = x0 + oled->origin_x;
+	int16_t disp_y = y0 + oled->origin_y;
+	struct OLED_box_s box = {disp_x - rx, disp_y - ry, disp_x + rx, disp_y + ry};
+	bool is_checked = !OLED_is_inside_clip_(oled, &box);
+	if (!OLED_clip_box_(oled, &box))
+		return OLED_EBOUNDS;
+
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer) {
+		const struct OLED_dl_ellipse_s rec = {x0, y0, rx, ry, params};
+		return OLED_dl_add_(oled, is_circle ? OLED_DL_CIRCLE : OLED_DL_ELLIPSE,
+				    &rec, sizeof rec, NULL, 0,
+				    box.x_from, box.y_from, box.x_to, box.y_to);
+	}
+#endif
+	OLED_mark_dirty_(oled, box.x_from, box.x_to, box.y_from / 8, box.y_to / 8);
+
+	const struct OLED_arcs_s arcs = {disp_x, disp_y, disp_x, disp_y};
+	if (!rx || !ry) {
+		/* Degenerates to a line, which would have gaps otherwise */
+		OLED_arcs_cols_(oled, &arcs, 0, ry, pixel_color);
+		for (uint8_t dx = 1; dx <= rx; dx++)
+			OLED_arcs_cols_(oled, &arcs, dx, 0, pixel_color);
+	} else if (is_circle) {
+		OLED_circle_(oled, &arcs, rx, is_fill, is_checked, pixel_color);
+	} else {
+		OLED_ellipse_(oled, &arcs, rx, ry, is_fill, is_checked, pixel_color);
+	}
+	return OLED_EOK;
+}
+
+
+OLED_err OLED_put_circle(OLED *oled, int16_t x0, int16_t y0, uint8_t r, enum OLED_params params)
+{
+	return OLED_put_ellipse_(oled, x0, y0, r, r, true, params);
+}
+
+
+OLED_err OLED_put_ellipse(OLED *oled, int16_t x0, int16_t y0, uint8_t rx, uint8_t ry,
+			  enum OLED_params params)
+{
+	return OLED_put_ellipse_(oled, x0, y0, rx, ry, false, params);
+}
+
+
+OLED_err OLED_put_roundRect(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, uint8_t r, enum OLED_params params)
+{
+	if (params > (OLED_BLACK | OLED_FILL | OLED_XOR))
+		return OLED_EPARAMS;
+	uint8_t pixel_color = OLED_pixel_op_(params);
+	bool is_fill = (OLED_FILL & params) != 0;
+
+	/* Normalize coordinates */
+	uint8_t start_x = x_to < x_from ? x_to : x_from;
+	uint8_t start_y = y_to < y_from ? y_to : y_from;
+	uint8_t stop_x = x_to > x_from ? x_to : x_from;
+	uint8_t stop_y = y_to > y_from ? y_to : y_from;
+	/* Corners take at most half of each side */
+	if (r > (stop_x - start_x) / 2)
+		r = (stop_x - start_x) / 2;
+	if (r > (stop_y - start_y) / 2)
+		r = (stop_y - start_y) / 2;
+
+	/* Shape in display coordinates and its visible part */
+	const struct OLED_box_s rect = {
+		start_x + oled->origin_x, start_y + oled->origin_y,
+		stop_x + oled->origin_x, stop_y + oled->origin_y
+	};
+	struct OLED_box_s box = rect;
+	bool is_checked = !OLED_is_inside_clip_(oled, &box);
+	if (!OLED_clip_box_(oled, &box))
+		return OLED_EBOUNDS;
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer) {
+		const struct OLED_dl_roundrect_s rec = {start_x, start_y, stop_x, stop_y, r, params};
+		return OLED_dl_add_(oled, OLED_DL_ROUNDRECT, &rec, sizeof rec, NULL, 0,
+				    box.x_from, box.y_from, box.x_to, box.y_to);
+	}
+#endif
+	OLED_mark_dirty_(oled, box.x_from, box.x_to, box.y_from / 8, box.y_to / 8);
+
+	/* Fill is the block between arc centers plus arc columns at sides, */
+	/* outline is the arcs joined by straight edges			    */
+	const struct OLED_arcs_s arcs = {rect.x_from + r, rect.y_from + r, rect.x_to - r, rect.y_to - r};
+	OLED_circle_(oled, &arcs, r, is_fill, is_checked, pixel_color);
+	if (is_fill)
+		return OLED_EOK;
+
+	if (arcs.x_l + 1 <= arcs.x_r - 1) {
+		struct OLED_box_s edge = {arcs.x_l + 1, rect.y_from, arcs.x_r - 1, rect.y_from};
+		OLED_fill_box_(oled, edge, pixel_color);
+		if (rect.y_to != rect.y_from) {
+			edge.y_from = edge.y_to = rect.y_to;
+			OLED_fill_box_(oled, edge, pixel_color);
+		}
+	}
+	if (arcs.y_t + 1 <= arcs.y_b - 1) {
+		struct OLED_box_s edge = {rect.x_from, arcs.y_t + 1, rect.x_from, arcs.y_b - 1};
+		OLED_fill_box_(oled, edge, pixel_color);
+		if (rect.x_to != rect.x_from) {
+			edge.x_from = edge.x_to = rect.x_to;
+			OLED_fill_box_(oled, edge, pixel_color);
+		}
+	}
+	return OLED_EOK;
+}
+
+
+/***** Bitmaps and text *****/
+/* Bits of page which lie inside clip rows */
+static uint8_t OLED_clip_mask_(OLED *oled, uint8_t page)
+{
+	uint8_t top = 8 * page;
+	if ((top > oled->clip_y_to) || (top + 7 < oled->clip_y_from))
+		return 0x00;
+	uint8_t mask = 0xFF;
+	if (oled->clip_y_from > top)
+		mask <<= oled->clip_y_from - top;
+	if (oled->clip_y_to < top + 7)
+		mask &= 0xFF >> (top + 7 - oled->clip_y_to);
+	return mask;
+}
+
+
+/* Draws image of `pages` rows by w column bytes at (x, y), followed by	      */
+/* `blank` empty columns. Rows of the last page are limited by last_mask.     */
+/* Image is clipped by clip rectangle, x must not be right of it and y must   */
+/* be inside display. Destination is not marked dirty			      */
+static void OLED_blit_(OLED *oled, uint8_t x, uint8_t y, const uint8_t *src, bool is_progmem,
+		       uint8_t w, uint8_t pages, uint8_t last_mask, uint8_t blank,
+		       enum OLED_params params)
+{
+	uint8_t width = OLED_WIDTH(oled);
+	uint8_t num_pages = OLED_PAGES(oled);
+	/* Visible columns [col_from..col_to) of the image and blank ones */
+	uint8_t avail = oled->clip_x_to + 1 - x;
+	uint8_t col_from = (x < oled->clip_x_from) ? oled->clip_x_from - x : 0;
+	uint8_t col_to = ((uint16_t)w + blank < avail) ? w + blank : avail;
+	if (col_from >= col_to)
+		return;
+	uint8_t img_to = (w < col_to) ? w : col_to;
+	uint8_t blank_from = (img_to > col_from) ? img_to : col_from;
+	uint8_t page = y / 8;
+	uint8_t shift = y % 8;
+	bool pixel_state = params & OLED_BLACK;
+	bool is_xor = params & OLED_XOR;
+	bool is_opaque = !is_xor && (params & OLED_FILL);
+	uint8_t *row = &oled->frame_buffer[page * (uint16_t)width + x + col_from];
+	/* Byte multiplied by (1 << shift) holds bits for this page in its low */
+	/* byte and bits for the next page in the high one		       */
+	uint8_t mul = 1 << shift;
+
+	for (; pages && (page < num_pages); pages--, page++, src += w, row += width) {
+		if (8 * page > oled->clip_y_to)
+			break;
+		/* Clip rows are applied to bits of both pages. Page is not	*/
+		/* touched without them, as it may be out of display list band	*/
+		uint8_t clip_cur = OLED_clip_mask_(oled, page);
+		uint8_t clip_next = (shift && (page + 1 < num_pages)) ? OLED_clip_mask_(oled, page + 1) : 0;
+		bool has_cur = clip_cur;
+		bool has_next = clip_next;
+		uint16_t clip = clip_cur | ((uint16_t)clip_next << 8);
+		if (!clip)
+			continue;
+		uint8_t img_mask = (1 == pages) ? last_mask : 0xFF;
+		OLED_PROFWRAP(OLED_prof_data.pixels += (uint16_t)(col_to - col_from)
+							* __builtin_popcount((img_mask * mul) & clip);)
+		if (!shift && is_opaque && pixel_state && (0xFF == img_mask) && (0xFF == clip)) {
+			/* Aligned copy: image bytes are frame_buffer bytes */
+			if (img_to > col_from) {
+				if (is_progmem)
+					memcpy_P(row, &src[col_from], img_to - col_from);
+				else
+					memcpy(row, &src[col_from], img_to - col_from);
 			}
-			for (uint8_t y = start_y; y <= stop_y; y++) {
-				OLED_put_pixel_(oled, start_x, y, pixel_color);
-				OLED_put_pixel_(oled, stop_x, y, pixel_color);
+			memset(&row[blank_from - col_from], 0x00, col_to - blank_from);
+			continue;
+		}
+		uint16_t mask = (img_mask * mul) & clip;
+		uint8_t keep_lo = ~(uint8_t)mask;
+		uint8_t keep_hi = ~(uint8_t)(mask >> 8);
+		uint8_t *dst = row;
+		for (uint8_t c = col_from; c < col_to; c++, dst++) {
+			uint8_t byte = 0;
+			if (c < img_to)
+				byte = (is_progmem ? pgm_read_byte(&src[c]) : src[c]) & img_mask;
+			uint16_t bits = (byte * mul) & clip;
+			if (is_xor) {
+				if (has_cur)
+					dst[0] ^= (uint8_t)bits;
+				if (has_next)
+					dst[width] ^= (uint8_t)(bits >> 8);
+			} else if (is_opaque) {
+				if (!pixel_state)
+					bits ^= mask;
+				if (has_cur)
+					dst[0] = (dst[0] & keep_lo) | (uint8_t)bits;
+				if (has_next)
+					dst[width] = (dst[width] & keep_hi) | (uint8_t)(bits >> 8);
+			} else if (pixel_state) {
+				if (has_cur)
+					dst[0] |= (uint8_t)bits;
+				if (has_next)
+					dst[width] |= (uint8_t)(bits >> 8);
+			} else {
+				if (has_cur)
+					dst[0] &= ~(uint8_t)bits;
+				if (has_next)
+					dst[width] &= ~(uint8_t)(bits >> 8);
 			}
 		}
-	//}
+	}
+}
+
+
+static OLED_err OLED_put_bitmap_(OLED *oled, uint8_t x, uint8_t y, uint8_t w, uint8_t h,
+				 const uint8_t *bitmap, bool is_progmem, enum OLED_params params)
+{
+	if (!w || !h || (params > (OLED_BLACK | OLED_FILL | OLED_XOR)))
+		return OLED_EPARAMS;
+	int16_t disp_x = x + oled->origin_x;
+	int16_t disp_y = y + oled->origin_y;
+	struct OLED_box_s box = {disp_x, disp_y, disp_x + w - 1, disp_y + h - 1};
+	if (!OLED_clip_box_(oled, &box))
+		return OLED_EBOUNDS;
+
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer) {
+		const struct OLED_dl_image_s rec = {bitmap, x, y, w, h, params};
+		return OLED_dl_add_(oled, is_progmem ? OLED_DL_BITMAP_P : OLED_DL_BITMAP,
+				    &rec, sizeof rec, NULL, 0,
+				    box.x_from, box.y_from, box.x_to, box.y_to);
+	}
+#endif
+
+	uint8_t pages = (h + 7) / 8;
+	uint8_t last_mask = (uint8_t)(0xFF >> ((8 - h % 8) % 8));
+	OLED_blit_(oled, disp_x, disp_y, bitmap, is_progmem, w, pages, last_mask, 0, params);
+	OLED_mark_dirty_(oled, box.x_from, box.x_to, box.y_from / 8, box.y_to / 8);
+	return OLED_EOK;
+}
+
+
+OLED_err OLED_put_bitmap(OLED *oled, uint8_t x, uint8_t y, uint8_t w, uint8_t h, const uint8_t *bitmap, enum OLED_params params)
+{
+	return OLED_put_bitmap_(oled, x, y, w, h, bitmap, false, params);
+}
+
+
+OLED_err OLED_put_bitmap_P(OLED *oled, uint8_t x, uint8_t y, uint8_t w, uint8_t h, const uint8_t *bitmap, enum OLED_params params)
+{
+	return OLED_put_bitmap_(oled, x, y, w, h, bitmap, true, params);
+}
+
+
+#if !defined(OLED_FIXED_WIDTH)
+/* Surface buffer has the layout of bitmap, so it is blitted the same way */
+OLED_err OLED_composite(OLED *oled, uint8_t x, uint8_t y, const OLED *surface, enum OLED_params params)
+{
+	return OLED_put_bitmap_(oled, x, y, surface->width, surface->height,
+				surface->frame_buffer, false, params);
+}
+#endif
+
 
+/***** Compressed images *****/
+/* Format is described at OLED_put_rle_P. Runs do not cross pages, so any   */
+/* page is decoded without the ones above it				    */
+#define OLED_RLE_HEADER_LEN 2
+#define OLED_RLE_MIN_REPEAT 3	/* Shorter repeats are stored as literal */
+#define OLED_RLE_CHUNK 16	/* Columns decoded at once for OLED_blit_ */
+
+/* Reader of run list of one page */
+struct OLED_rle_s {
+	const uint8_t *src;	/* Control byte of the next run */
+	const uint8_t *data;	/* Literal bytes, or the repeated one */
+	uint8_t left;		/* Bytes left in the current run */
+	bool is_repeat;
+};
+
+
+static void OLED_rle_seek_(struct OLED_rle_s *rle, const uint8_t *image, uint8_t page)
+{
+	rle->src = image + pgm_read_word(&image[OLED_RLE_HEADER_LEN + 2 * page]);
+	rle->left = 0;
+}
+
+
+/* Expands next len bytes of page into dst, or skips them if dst is NULL. */
+/* Repeated byte is a memset, literal bytes are a memcpy_P		  */
+static void OLED_rle_read_(struct OLED_rle_s *rle, uint8_t *dst, uint8_t len)
+{
+	while (len) {
+		if (!rle->left) {
+			uint8_t ctrl = pgm_read_byte(rle->src++);
+			rle->is_repeat = ctrl & 0x80;
+			rle->left = rle->is_repeat ? (ctrl & 0x7F) + OLED_RLE_MIN_REPEAT : ctrl + 1;
+			rle->data = rle->src;
+			rle->src += rle->is_repeat ? 1 : rle->left;
+		}
+		uint8_t n = (len < rle->left) ? len : rle->left;
+		if (NULL != dst) {
+			if (rle->is_repeat)
+				memset(dst, pgm_read_byte(rle->data), n);
+			else
+				memcpy_P(dst, rle->data, n);
+			dst += n;
+		}
+		if (!rle->is_repeat)
+			rle->data += n;
+		rle->left -= n;
+		len -= n;
+	}
+}
+
+
+OLED_err OLED_rle_page_P(const uint8_t *image, uint8_t page, uint8_t *buf)
+{
+	uint8_t w = pgm_read_byte(&image[0]);
+	uint8_t h = pgm_read_byte(&image[1]);
+	if (page >= (h + 7) / 8)
+		return OLED_EPARAMS;
+	struct OLED_rle_s rle;
+	OLED_rle_seek_(&rle, image, page);
+	OLED_rle_read_(&rle, buf, w);
+	return OLED_EOK;
+}
+
+
+OLED_err OLED_put_rle_P(OLED *oled, uint8_t x, uint8_t y, const uint8_t *image, enum OLED_params params)
+{
+	uint8_t w = pgm_read_byte(&image[0]);
+	uint8_t h = pgm_read_byte(&image[1]);
+	if (!w || !h || (params > (OLED_BLACK | OLED_FILL | OLED_XOR)))
+		return OLED_EPARAMS;
+	int16_t disp_x = x + oled->origin_x;
+	int16_t disp_y = y + oled->origin_y;
+	struct OLED_box_s box = {disp_x, disp_y, disp_x + w - 1, disp_y + h - 1};
+	if (!OLED_clip_box_(oled, &box))
+		return OLED_EBOUNDS;
+
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer) {
+		const struct OLED_dl_image_s rec = {image, x, y, w, h, params};
+		return OLED_dl_add_(oled, OLED_DL_RLE_P, &rec, sizeof rec, NULL, 0,
+				    box.x_from, box.y_from, box.x_to, box.y_to);
+	}
+#endif
+
+	uint8_t pages = (h + 7) / 8;
+	uint8_t last_mask = (uint8_t)(0xFF >> ((8 - h % 8) % 8));
+	/* Visible columns [col_from..col_to) and pages of the image */
+	uint8_t col_from = box.x_from - disp_x;
+	uint8_t col_to = box.x_to - disp_x + 1;
+	uint8_t page_to = (box.y_to - disp_y) / 8;
+	bool is_copy = !(disp_y % 8) && ((OLED_FILL | OLED_BLACK) == params);
+	for (uint8_t p = (box.y_from - disp_y) / 8; p <= page_to; p++) {
+		uint8_t row_y = disp_y + 8 * p;
+		uint8_t img_mask = (p + 1 == pages) ? last_mask : 0xFF;
+		struct OLED_rle_s rle;
+		OLED_rle_seek_(&rle, image, p);
+		OLED_rle_read_(&rle, NULL, col_from);
+		if (is_copy && (0xFF == img_mask) && (0xFF == OLED_clip_mask_(oled, row_y / 8))) {
+			/* Page bytes are frame_buffer bytes, runs are expanded in place */
+			uint8_t *row = &oled->frame_buffer[(row_y / 8) * (uint16_t)OLED_WIDTH(oled)
+							   + disp_x + col_from];
+			OLED_rle_read_(&rle, row, col_to - col_from);
+			OLED_PROFWRAP(OLED_prof_data.pixels += 8 * (uint16_t)(col_to - col_from);)
+			continue;
+		}
+		/* Other modes and partly clipped pages are blitted by chunks */
+		uint8_t chunk[OLED_RLE_CHUNK];
+		for (uint8_t c = col_from; c < col_to; c += OLED_RLE_CHUNK) {
+			uint8_t n = (col_to - c < OLED_RLE_CHUNK) ? col_to - c : OLED_RLE_CHUNK;
+			OLED_rle_read_(&rle, chunk, n);
+			OLED_blit_(oled, disp_x + c, row_y, chunk, false, n, 1, img_mask, 0, params);
+		}
+	}
+	OLED_mark_dirty_(oled, box.x_from, box.x_to, box.y_from / 8, box.y_to / 8);
+	return OLED_EOK;
+}
+
+
+static OLED_err OLED_put_text_(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font,
+			       const char *str, bool is_progmem, enum OLED_params params)
+{
+	if (params > (OLED_BLACK | OLED_FILL | OLED_XOR))
+		return OLED_EPARAMS;
+	uint16_t disp_x = x + oled->origin_x;
+	uint16_t disp_y = y + oled->origin_y;
+	if ((disp_x > oled->clip_x_to) || (disp_y > oled->clip_y_to))
+		return OLED_EBOUNDS;
+#if !defined(OLED_NO_I2C)
+	if (NULL != oled->dlist_buffer)
+		return OLED_dl_text_(oled, x, y, font, str, is_progmem, params);
+#endif
+
+	x = disp_x;
+	y = disp_y;
+	uint8_t cell = font->width + font->spacing;
+	uint8_t line = 8 * font->pages;
+	uint16_t glyph_size = font->width * (uint16_t)font->pages;
+	uint8_t blank = (params & OLED_FILL) ? font->spacing : 0;
+	uint8_t x_start = x;
+	uint8_t y_start = y;
+	uint8_t x_end = x;	/* Past the last column drawn */
+	bool is_drawn = false;
+
+	while (true) {
+		uint8_t c = is_progmem ? pgm_read_byte(str) : *str;
+		str++;
+		if (!c)
+			break;
+		if ('\n' == c) {
+			if (line > oled->clip_y_to - y)
+				break;
+			x = x_start;
+			y += line;
+			continue;
+		}
+		if (x > oled->clip_x_to)
+			continue;	/* Clipped till the end of line */
+		if ((c < (uint8_t)font->first) || (c > (uint8_t)font->last))
+			c = font->first;
+		OLED_blit_(oled, x, y, &font->glyphs[(c - (uint8_t)font->first) * glyph_size], true,
+			   font->width, font->pages, 0xFF, blank, params);
+		is_drawn = true;
+		x = (cell <= oled->clip_x_to - x) ? x + cell : oled->clip_x_to + 1;
+		if (x > x_end)
+			x_end = x;
+	}
+
+	struct OLED_box_s box = {x_start, y_start, x_end - 1, y + line - 1};
+	if (is_drawn && OLED_clip_box_(oled, &box))
+		OLED_mark_dirty_(oled, box.x_from, box.x_to, box.y_from / 8, box.y_to / 8);
+	return OLED_EOK;
+}
+
+
+OLED_err OLED_put_text(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font, const char *str, enum OLED_params params)
+{
+	return OLED_put_text_(oled, x, y, font, str, false, params);
+}
+
+
+OLED_err OLED_put_text_P(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font, const char *str, enum OLED_params params)
+{
+	return OLED_put_text_(oled, x, y, font, str, true, params);
+}
+
+
+OLED_err OLED_put_char(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font, char c, enum OLED_params params)
+{
+	const char str[2] = {c, '\0'};
+	return OLED_put_text_(oled, x, y, font, str, false, params);
+}
+
+
+#if !defined(OLED_NO_I2C)
+/***** Display list *****/
+/* Record is a header followed by arguments of the draw call. Pages is a    */
+/* mask of pages touched by its bounding box, so render skips records of    */
+/* other pages without looking at arguments				    */
+struct OLED_dl_head_s {
+	uint8_t op;
+	uint8_t pages;
+	uint8_t len;		/* Of what follows the header */
+};
+
+
+/* Appends record for pages of the mask */
+static OLED_err OLED_dl_push_(OLED *oled, uint8_t op, uint8_t pages, const void *args,
+			      uint8_t args_len, const char *str, uint8_t str_len)
+{
+	uint16_t len = oled->dlist_len;
+	uint16_t rec_len = sizeof(struct OLED_dl_head_s) + args_len + str_len;
+	if (rec_len > oled->dlist_size - len)
+		return OLED_EBOUNDS;
+	const struct OLED_dl_head_s head = {
+		.op = op,
+		.pages = pages,
+		.len = args_len + str_len
+	};
+	uint8_t *ptr = &oled->dlist_buffer[len];
+	memcpy(ptr, &head, sizeof head);
+	memcpy(ptr + sizeof head, args, args_len);
+	if (str_len)
+		memcpy(ptr + sizeof head + args_len, str, str_len);
+	/* Render sees the record only when it is complete */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		oled->dlist_len = len + rec_len;
+	}
+	return OLED_EOK;
+}
+
+
+/* Appends record of draw call and marks its bounding box dirty. Box is the */
+/* visible part, in display coordinates					    */
+static OLED_err OLED_dl_add_(OLED *oled, uint8_t op, const void *args, uint8_t args_len,
+			     const char *str, uint8_t str_len, uint8_t x_from, uint8_t y_from,
+			     uint8_t x_to, uint8_t y_to)
+{
+	uint8_t page_from = y_from / 8;
+	uint8_t page_to = y_to / 8;
+	uint8_t pages = (uint8_t)(0xFF << page_from) & (uint8_t)(0xFF >> (7 - page_to));
+	OLED_err err = OLED_dl_push_(oled, op, pages, args, args_len, str, str_len);
+	if (OLED_EOK == err)
+		OLED_mark_dirty_(oled, x_from, x_to, page_from, page_to);
+	return err;
+}
+
+
+/* Records clip and origin for the draw calls which follow */
+static OLED_err OLED_dl_view_(OLED *oled, const struct OLED_view_s *view)
+{
+	return OLED_dl_push_(oled, OLED_DL_VIEW, 0xFF, view, sizeof *view, NULL, 0);
+}
+
+
+/* Empties the list. View of draw calls to come is recorded, unless it is */
+/* the initial one render starts with					  */
+static void OLED_dl_restart_(OLED *oled, bool background)
+{
+	oled->dlist_len = 0;
+	oled->dlist_background = background;
+	if (oled->clip_x_from || oled->clip_y_from || oled->origin_x || oled->origin_y
+	    || (OLED_WIDTH(oled) - 1 != oled->clip_x_to)
+	    || (OLED_HEIGHT(oled) - 1 != oled->clip_y_to)) {
+		struct OLED_view_s view;
+		OLED_get_view_(oled, &view);
+		OLED_dl_view_(oled, &view);
+	}
+}
+
+
+/* Records text. Its box is the longest line by number of lines */
+static OLED_err OLED_dl_text_(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font,
+			      const char *str, bool is_progmem, enum OLED_params params)
+{
+	uint16_t len = 0;
+	uint8_t chars = 0;
+	uint8_t max_chars = 0;
+	uint8_t lines = 1;
+	for (;; len++) {
+		char c = is_progmem ? pgm_read_byte(&str[len]) : str[len];
+		if (!c)
+			break;
+		if ('\n' == c) {
+			lines++;
+			chars = 0;
+		} else if ((chars < 255) && (++chars > max_chars)) {
+			max_chars = chars;
+		}
+	}
+	int16_t disp_x = x + oled->origin_x;
+	int16_t disp_y = y + oled->origin_y;
+	struct OLED_box_s box = {
+		disp_x, disp_y,
+		disp_x + OLED_TEXT_WIDTH(font, (int16_t)max_chars) - 1,
+		disp_y + lines * 8 * (int16_t)font->pages - 1
+	};
+	if (!max_chars || !OLED_clip_box_(oled, &box))
+		return OLED_EOK;	/* Nothing is drawn */
+
+	const struct OLED_dl_text_s rec = {font, is_progmem ? str : NULL, x, y, params};
+	if (is_progmem)
+		return OLED_dl_add_(oled, OLED_DL_TEXT_P, &rec, sizeof rec, NULL, 0,
+				    box.x_from, box.y_from, box.x_to, box.y_to);
+	/* Record length must fit in its header */
+	if (len + 1 > (uint16_t)(UINT8_MAX - sizeof rec))
+		return OLED_EBOUNDS;
+	return OLED_dl_add_(oled, OLED_DL_TEXT, &rec, sizeof rec, str, len + 1,
+			    box.x_from, box.y_from, box.x_to, box.y_to);
+}
+
+
+/* Loads recorded view with clip rows narrowed to the page. Returns false */
+/* if nothing of the page is inside the clip				  */
+static bool OLED_dl_band_(OLED *oled, const struct OLED_view_s *view, uint8_t page)
+{
+	OLED_load_view_(oled, view);
+	if (oled->clip_y_from < 8 * page)
+		oled->clip_y_from = 8 * page;
+	if (oled->clip_y_to > 8 * page + 7)
+		oled->clip_y_to = 8 * page + 7;
+	return oled->clip_y_from <= oled->clip_y_to;
+}
+
+
+/* Render callback of display list mode. Draw routines are replayed with  */
+/* frame_buffer shifted so that the page lies at buf, and with clip rows  */
+/* limited to the page, so nothing else is written. State they change is */
+/* restored afterwards							  */
+static void OLED_dl_render_(void *args, uint8_t page, uint8_t *buf)
+{
+	OLED *oled = args;
+	uint8_t width = OLED_WIDTH(oled);
+	memset(buf, oled->dlist_background ? 0xFF : 0x00, width);
+
+	uint8_t *list = oled->dlist_buffer;
+	uint16_t len = oled->dlist_len;
+	uint8_t page_bit = 1 << page;
+	uint8_t *frame_buffer = oled->frame_buffer;
+	uint8_t dirty_pages = oled->dirty_pages;
+	uint8_t dirty_from[OLED_MAX_PAGES];
+	uint8_t dirty_to[OLED_MAX_PAGES];
+	memcpy(dirty_from, oled->dirty_from, sizeof dirty_from);
+	memcpy(dirty_to, oled->dirty_to, sizeof dirty_to);
+	struct OLED_view_s user_view;
+	OLED_get_view_(oled, &user_view);
+
+	oled->dlist_buffer = NULL;	/* Draw, do not record */
+	oled->frame_buffer = buf - page * (uint16_t)width;
+	OLED_PROFWRAP(uint32_t prof_pixels = OLED_prof_data.pixels;)
+	/* List starts with the whole display as clip and no origin */
+	struct OLED_view_s view = {0, 0, width - 1, OLED_HEIGHT(oled) - 1, 0, 0};
+	bool is_visible = OLED_dl_band_(oled, &view, page);
+
+	for (uint16_t i = 0; i < len;) {
+		struct OLED_dl_head_s head;
+		memcpy(&head, &list[i], sizeof head);
+		const uint8_t *rec = &list[i + sizeof head];
+		i += sizeof head + head.len;
+		if (OLED_DL_VIEW == head.op) {
+			memcpy(&view, rec, sizeof view);
+			is_visible = OLED_dl_band_(oled, &view, page);
+			continue;
+		}
+		if (!is_visible || !(head.pages & page_bit))
+			continue;
+
+		struct OLED_dl_shape_s shape;
+		struct OLED_dl_image_s image;
+		struct OLED_dl_text_s text;
+		struct OLED_dl_ellipse_s ellipse;
+		struct OLED_dl_roundrect_s roundrect;
+		switch (head.op) {
+		case OLED_DL_PIXEL:
+			memcpy(&shape, rec, sizeof shape);
+			OLED_put_pixel(oled, shape.x_from, shape.y_from, shape.params);
+			break;
+		case OLED_DL_RECT:
+			memcpy(&shape, rec, sizeof shape);
+			OLED_put_rectangle(oled, shape.x_from, shape.y_from, shape.x_to, shape.y_to,
+					   shape.params);
+			break;
+		case OLED_DL_LINE:
+			memcpy(&shape, rec, sizeof shape);
+			OLED_put_line(oled, shape.x_from, shape.y_from, shape.x_to, shape.y_to,
+				      shape.params);
+			break;
+		case OLED_DL_BITMAP:
+		case OLED_DL_BITMAP_P:
+			memcpy(&image, rec, sizeof image);
+			OLED_put_bitmap_(oled, image.x, image.y, image.w, image.h, image.bitmap,
+					 OLED_DL_BITMAP_P == head.op, image.params);
+			break;
+		case OLED_DL_RLE_P:
+			memcpy(&image, rec, sizeof image);
+			OLED_put_rle_P(oled, image.x, image.y, image.bitmap, image.params);
+			break;
+		case OLED_DL_TEXT:
+			memcpy(&text, rec, sizeof text);
+			OLED_put_text_(oled, text.x, text.y, text.font,
+				       (const char *)&rec[sizeof text], false, text.params);
+			break;
+		case OLED_DL_TEXT_P:
+			memcpy(&text, rec, sizeof text);
+			OLED_put_text_(oled, text.x, text.y, text.font, text.str, true, text.params);
+			break;
+		case OLED_DL_ROUNDRECT:
+			memcpy(&roundrect, rec, sizeof roundrect);
+			OLED_put_roundRect(oled, roundrect.x_from, roundrect.y_from, roundrect.x_to,
+					   roundrect.y_to, roundrect.r, roundrect.params);
+			break;
+		case OLED_DL_CIRCLE:
+		case OLED_DL_ELLIPSE:
+			memcpy(&ellipse, rec, sizeof ellipse);
+			OLED_put_ellipse_(oled, ellipse.x0, ellipse.y0, ellipse.rx, ellipse.ry,
+					  OLED_DL_CIRCLE == head.op, ellipse.params);
+			break;
+		}
+	}
+
+	OLED_PROFWRAP(
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			prof_isr_pixels += OLED_prof_data.pixels - prof_pixels;
+		}
+		OLED_prof_data.pixels = prof_pixels;
+	)
+	OLED_load_view_(oled, &user_view);
+	oled->frame_buffer = frame_buffer;
+	oled->dlist_buffer = list;
+	oled->dirty_pages = dirty_pages;
+	memcpy(oled->dirty_from, dirty_from, sizeof dirty_from);
+	memcpy(oled->dirty_to, dirty_to, sizeof dirty_to);
+}
+
+
+OLED_err OLED_set_dlist(OLED *oled, uint8_t *page_buffer, uint8_t *list, uint16_t list_size)
+{
+	if (NULL == list)
+		return OLED_set_render(oled, NULL, NULL, NULL);
+	OLED_err err = OLED_set_render(oled, page_buffer, &OLED_dl_render_, oled);
+	if (OLED_EOK != err)
+		return err;
+	OLED_spinlock(oled);
+	oled->dlist_size = list_size;
+	oled->dlist_buffer = list;
+	OLED_dl_restart_(oled, false);
+	OLED_mark_dirty_(oled, 0, OLED_WIDTH(oled) - 1, 0, OLED_PAGES(oled) - 1);
+	OLED_unlock(oled);
 	return OLED_EOK;
-}
\ No newline at end of file
+}
+#endif // OLED_NO_I2C
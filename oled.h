@@ -37,6 +37,20 @@
 	#warning "OLED: OLED_CMDBUFFER_LEN not set. Using " ##OLED_CMDBUFFER_LEN " as fallback"
 #endif
 
+#if !defined(OLED_NO_I2C) && !defined(OLED_I2C_QUEUE_LEN)
+	#define OLED_I2C_QUEUE_LEN 4
+	#warning "OLED: OLED_I2C_QUEUE_LEN not set. Using 4 as fallback"
+#endif
+
+/* Define OLED_I2C_NAKED_ISR to use hand-written assembly fast path of TWI    */
+/* ISR, which takes less cycles per byte sent. See I2C transport in oled.c   */
+
+/* Define OLED_I2C_IGNORE_NACK to treat NACK of written bytes as ACK. Only   */
+/* for simulators without a device on the bus (see `make bench`)	     */
+#if defined(OLED_I2C_IGNORE_NACK) && defined(OLED_I2C_NAKED_ISR)
+	#error "OLED: OLED_I2C_IGNORE_NACK is not supported by naked TWI ISR"
+#endif
+
 #if defined(OLED_NO_I2C)
 	#warning "OLED: building without I2C"
 	#define OLED_I2CWRAP(BLOCK)
@@ -44,21 +58,140 @@
 	#define OLED_I2CWRAP(BLOCK) BLOCK
 #endif
 
-#if !(defined(TWBR) && defined(TWSR) && defined(TWAR) && defined(TWDR)) && !defined(OLED_NO_I2C)
+#if !(defined(TWBR) && defined(TWSR) && defined(TWAR) && defined(TWDR)) && !defined(OLED_NO_I2C) && !defined(OLED_SPI)
 	#error "OLED: AVR target has no TWI peripheral. I2C is required by lib"
 #endif
 
+/* SCL and SDA pins are driven by lib only to recover stuck bus, as TWI    */
+/* module can not do that. Pull-ups are expected to be external		   */
+#if !defined(OLED_NO_I2C) && !defined(OLED_SPI)
+	#if !defined(OLED_I2C_PORT)
+		#define OLED_I2C_PORT PORTC
+		#define OLED_I2C_DDR DDRC
+		#define OLED_I2C_PIN PINC
+		#define OLED_I2C_SCL PC5
+		#define OLED_I2C_SDA PC4
+		#warning "OLED: OLED_I2C_PORT not set. Using ATmega328P TWI pins as fallback"
+	#endif
+	#if !defined(OLED_I2C_TIMEOUT_TICKS)
+		#define OLED_I2C_TIMEOUT_TICKS 10
+		#warning "OLED: OLED_I2C_TIMEOUT_TICKS not set. Using 10 as fallback"
+	#endif
+#endif
+
+/* 4-wire SPI transport is used instead of I2C if OLED_SPI is defined.	      */
+/* Besides MOSI and SCK it needs chip select (CS#) and data/command (D/C#)    */
+/* lines. Optional RES# line is pulsed on init if OLED_SPI_RST_* are defined */
+/* On XMEGA SPI transport is run by USART in master SPI mode, with data moved */
+/* to it by DMA controller. Pins are given as PORT_t and pin bit masks	      */
+#if defined(OLED_SPI) && !defined(OLED_NO_I2C) && defined(__AVR_XMEGA__)
+	#if !defined(OLED_XSPI_USART)
+		#define OLED_XSPI_USART USARTC0
+		#define OLED_XSPI_PORT PORTC
+		#define OLED_XSPI_XCK_bm PIN1_bm
+		#define OLED_XSPI_TXD_bm PIN3_bm
+		#define OLED_XSPI_DMA_TRIG DMA_CH_TRIGSRC_USARTC0_DRE_gc
+		#define OLED_XSPI_POWER_ENABLE() (PR.PRPC &= ~PR_USART0_bm)
+		#warning "OLED: OLED_XSPI_USART not set. Using USARTC0 as fallback"
+	#endif
+	#if !defined(OLED_XSPI_DMA_CH)
+		#define OLED_XSPI_DMA_CH DMA.CH0
+		#define OLED_XSPI_DMA_vect DMA_CH0_vect
+		#warning "OLED: OLED_XSPI_DMA_CH not set. Using DMA.CH0 as fallback"
+	#endif
+	#if !defined(OLED_XSPI_CS_PORT)
+		#define OLED_XSPI_CS_PORT PORTC
+		#define OLED_XSPI_CS_bm PIN4_bm
+		#warning "OLED: OLED_XSPI_CS_PORT not set. Using PC4 as fallback"
+	#endif
+	#if !defined(OLED_XSPI_DC_PORT)
+		#define OLED_XSPI_DC_PORT PORTC
+		#define OLED_XSPI_DC_bm PIN0_bm
+		#warning "OLED: OLED_XSPI_DC_PORT not set. Using PC0 as fallback"
+	#endif
+#elif defined(OLED_SPI) && !defined(OLED_NO_I2C)
+	#if !(defined(SPCR) && defined(SPSR) && defined(SPDR))
+		#error "OLED: AVR target has no SPI peripheral. SPI is required by OLED_SPI"
+	#endif
+	#if !defined(OLED_SPI_DDR)
+		/* Hardware SPI pins of ATmega48/88/168/328 */
+		#define OLED_SPI_DDR DDRB
+		#define OLED_SPI_MOSI PB3
+		#define OLED_SPI_SCK PB5
+		#define OLED_SPI_SS PB2
+		#warning "OLED: OLED_SPI_DDR not set. Using ATmega328P SPI pins as fallback"
+	#endif
+	#if !defined(OLED_SPI_CS_PORT)
+		#define OLED_SPI_CS_PORT PORTB
+		#define OLED_SPI_CS_DDR DDRB
+		#define OLED_SPI_CS_BIT PB2
+		#warning "OLED: OLED_SPI_CS_PORT not set. Using PB2 as fallback"
+	#endif
+	#if !defined(OLED_SPI_DC_PORT)
+		#define OLED_SPI_DC_PORT PORTB
+		#define OLED_SPI_DC_DDR DDRB
+		#define OLED_SPI_DC_BIT PB1
+		#warning "OLED: OLED_SPI_DC_PORT not set. Using PB1 as fallback"
+	#endif
+#endif
+
+/* Define OLED_PROFILE to build with counters of pixels drawn, bytes sent,    */
+/* time in transport ISR and lock waits (see OLED_prof_read). Time is read     */
+/* from OLED_PROF_TIMER, a free running 16-bit timer set up by application    */
+#if defined(OLED_PROFILE)
+	#define OLED_PROFWRAP(BLOCK) BLOCK
+	#if !defined(OLED_PROF_TIMER)
+		#define OLED_PROF_TIMER TCNT1
+		#warning "OLED: OLED_PROF_TIMER not set. Using TCNT1 as fallback"
+	#endif
+	#if defined(OLED_I2C_NAKED_ISR) && !defined(OLED_SPI)
+		#error "OLED: OLED_PROFILE can not time naked TWI ISR"
+	#endif
+#else
+	#define OLED_PROFWRAP(BLOCK)
+#endif
+
 /* GCC provides special attribute, indicating that function is not only tried */
 /* to be inlined, but must be ALWAYS inlined instead.			      */
 #define ALWAYSINLINE __attribute__((__always_inline__))
 
 #define OLED_ARR_SIZE(arr) (sizeof (arr) / sizeof *(arr))
 
+/* SSD1306 GDDRAM is organized as 8 pages, each 8 pixels tall */
+#define OLED_MAX_PAGES 8
+
+/* Size in bytes of frame_buffer for display of w x h pixels */
+#define OLED_FB_SIZE(w, h) ((uint16_t)(w) * ((h) / 8))
+
+/* Defining both OLED_FIXED_WIDTH and OLED_FIXED_HEIGHT makes geometry a      */
+/* compile time constant for all displays, so that pixel indexing becomes    */
+/* shifts and bounds checks are folded by compiler. Library code reads	      */
+/* geometry only through the accessors below				      */
+#if defined(OLED_FIXED_WIDTH) != defined(OLED_FIXED_HEIGHT)
+	#error "OLED: both OLED_FIXED_WIDTH and OLED_FIXED_HEIGHT must be defined"
+#endif
+#if defined(OLED_FIXED_WIDTH)
+	#if (OLED_FIXED_WIDTH % 8) || (OLED_FIXED_HEIGHT % 8)	\
+	    || (OLED_FIXED_WIDTH > 128) || (OLED_FIXED_HEIGHT > 8 * OLED_MAX_PAGES)
+		#error "OLED: fixed geometry must be a multiple of 8 and fit in GDDRAM"
+	#endif
+	#define OLED_WIDTH(oled) ((uint8_t)OLED_FIXED_WIDTH)
+	#define OLED_HEIGHT(oled) ((uint8_t)OLED_FIXED_HEIGHT)
+	#define OLED_PAGES(oled) ((uint8_t)(OLED_FIXED_HEIGHT / 8))
+#else
+	#define OLED_WIDTH(oled) ((oled)->width)
+	#define OLED_HEIGHT(oled) ((oled)->height)
+	#define OLED_PAGES(oled) ((uint8_t)((oled)->height / 8))
+#endif
+
 typedef enum OLED_err_e_ {
 	OLED_EOK = 0,
 	OLED_EBOUNDS,	/* Pixel is out of display bounds 	*/
 	OLED_EPARAMS,	/* Wrong parameters specified		*/
-	OLED_EBUSY	/* Indicates display is busy (locked)	*/
+	OLED_EBUSY,	/* Indicates display is busy (locked)	*/
+	OLED_ENACK,	/* Device did not acknowledge transfer	*/
+	OLED_EBUS,	/* Bus error or arbitration is lost	*/
+	OLED_ETIMEOUT	/* Transfer did not finish in time	*/
 } OLED_err;
 
 enum OLED_params {
@@ -66,7 +199,9 @@ enum OLED_params {
 	OLED_WHITE = 0x00,		/* Alias for 0 as color	      */
 	OLED_BLACK = 0x01,		/* Alias for 1 as color	      */
 	OLED_NO_FILL = 0x00,		/* Do not fill the drawn area */
-	OLED_FILL = 0x02		/* Fill the area	      */
+	OLED_FILL = 0x02,		/* Fill the area	      */
+	OLED_XOR = 0x04			/* Invert pixels instead of   */
+					/* setting, color ignored     */
 };
 
 /* Lock type. Need to be volatile to prevent optimizations */
@@ -79,17 +214,70 @@ typedef struct OLED_s_ {
 	uint8_t height;
 	lock_t busy_lock;	/* Locks when operations on OLED are in process */
 	uint8_t *frame_buffer;	/* A *flat* array which contents are displayed */
+	uint8_t clip_x_from;	/* Clip rectangle draw routines are limited */
+	uint8_t clip_y_from;	/* to, inside display. Rows are narrowed to */
+	uint8_t clip_x_to;	/* one page while display list is rendered  */
+	uint8_t clip_y_to;
+	uint8_t origin_x;	/* Added to coordinates given to draw routines */
+	uint8_t origin_y;
 	OLED_I2CWRAP(		/* Included only if no OLED_NO_I2C defined */
 		uint8_t i2c_addr;
 		uint8_t cur_page;
-		uint8_t num_pages;
+		uint8_t dirty_pages;	/* Bit N is set when page N was changed */
+		uint8_t tx_pages;	/* Pages left to be sent by refresh	*/
+		uint8_t dirty_from[OLED_MAX_PAGES];	/* First changed column */
+		uint8_t dirty_to[OLED_MAX_PAGES];	/* Last changed column	*/
+		bool is_fullwin;	/* Address window covers whole display	*/
+		uint8_t *tx_buffer;	/* Buffer being sent. Differs from	*/
+					/* frame_buffer if double-buffered	*/
+		uint8_t tx_from[OLED_MAX_PAGES];	/* Snapshot of dirty spans */
+		uint8_t tx_to[OLED_MAX_PAGES];		/* taken by refresh	   */
+		void (*refresh_cbk)(void *, OLED_err);	/* Called when refresh	*/
+							/* is over		*/
+		void *refresh_cbk_args;
+		/* Bufferless mode. Page is rendered just before it is sent */
+		void (*render_cbk)(void *, uint8_t, uint8_t *);
+		void *render_cbk_args;
+		uint8_t *render_buffer;	/* Scratch of width bytes	*/
+		/* Display list mode. Draw calls are recorded, not rasterized */
+		uint8_t *dlist_buffer;
+		uint16_t dlist_size;
+		volatile uint16_t dlist_len;
+		bool dlist_background;	/* Color pages are cleared with */
+		uint8_t start_line;	/* GDDRAM row shown at the top	*/
+		bool is_startline_dirty;	/* Sent after next refresh */
+		/* Refresh scheduler, see OLED_refresh_request */
+		volatile uint8_t refresh_pending;	/* Kinds requested	*/
+		uint8_t frame_ticks;		/* Min ticks between starts	*/
+		volatile uint8_t frame_wait;	/* Ticks left till next start	*/
+		/* Buffer used to store commands being emmitted to display */
+		uint8_t cmdbuffer[OLED_CMDBUFFER_LEN];
+		uint8_t cmdbuffer_len;
 	)
 } OLED;
 
 
-#if !defined(OLED_NO_I2C)
-/* Buffer used to store commands being emmitted to display */
-extern uint8_t OLED_cmdbuffer[OLED_CMDBUFFER_LEN];
+#if defined(OLED_PROFILE)
+/* Counters shared by all displays. Updated from interrupts too, so read	*/
+/* them with OLED_prof_read, which also adds pixels drawn in interrupts	*/
+typedef struct OLED_prof_s_ {
+	uint32_t pixels;	/* Pixels covered by draw routines		*/
+	uint32_t bytes;		/* Bytes of transactions queued, incl. prefix	*/
+	uint16_t transactions;	/* Transactions queued			*/
+	uint16_t refreshes;	/* Refreshes started				*/
+	uint16_t pages;		/* Pages sent by refreshes			*/
+	uint32_t isr_ticks;	/* OLED_PROF_TIMER ticks in transport ISR	*/
+	uint32_t lock_ticks;	/* OLED_PROF_TIMER ticks in OLED_spinlock wait	*/
+} OLED_prof;
+
+extern OLED_prof OLED_prof_data;
+
+/* OLED_prof_read() - copies counters atomically
+ * @dst:	where to copy, may be NULL to only reset
+ * @is_reset:	zero the counters after copying, so nothing is lost between
+ *		reading and resetting
+ */
+void OLED_prof_read(OLED_prof *dst, bool is_reset);
 #endif
 
 
@@ -131,10 +319,11 @@ inline ALWAYSINLINE bool OLED_trylock(OLED *oled)
 	/* val = old;							    */
 
 	bool val = true;
-	asm volatile("lac %0, %A1" :
+	asm volatile("lac %a1, %0" :
+		     "+r" (val) :
 		     "z" (&oled->busy_lock) :
-		     "+r" (val));
-	return !val;
+		     "memory");
+	return val;
 }
 #else
 inline ALWAYSINLINE bool OLED_trylock(OLED *oled)
@@ -156,19 +345,40 @@ inline ALWAYSINLINE bool OLED_trylock(OLED *oled)
 			"out __SREG__, __tmp_reg__" :
 		/* Attributes below */
 			"=&r" (val) :
-			"z" (&oled->busy_lock)
+			"z" (&oled->busy_lock) :
+			"memory"
 		);
-	return !val;
+	/* Lock was acquired only if it was unlocked (1) before */
+	return val;
 }
 #endif
 
 
+/* Tests whether lock is held, i.e. display is busy with transaction. Does not
+ * acquire the lock, so result is only a hint: use OLED_trylock to act on it
+ */
+inline ALWAYSINLINE bool OLED_is_busy(OLED *oled)
+{
+	return !oled->busy_lock;
+}
+
+
 /* Cycles till the lock is unlocked, acquires it and only then exits
  * (!) Warning: may cause deadlock (infinite wait for resource to free)
  */
 inline ALWAYSINLINE bool OLED_spinlock(OLED *oled)
 {
+#if defined(OLED_PROFILE)
+	/* Summed per spin, so wait may be longer than timer period */
+	uint16_t last = OLED_PROF_TIMER;
+	while (!OLED_trylock(oled)) {
+		uint16_t now = OLED_PROF_TIMER;
+		OLED_prof_data.lock_ticks += (uint16_t)(now - last);
+		last = now;
+	}
+#else
 	while (!OLED_trylock(oled));
+#endif
 	return true;
 }
 
@@ -208,16 +418,40 @@ inline ALWAYSINLINE bool OLED_spinlock(OLED *oled)
 
 
 OLED_err __OLED_init(OLED *oled, uint8_t width, uint8_t height, uint8_t *frame_buffer, uint32_t i2c_freq_hz, uint8_t i2c_addr);
+#if defined(OLED_FIXED_WIDTH)
+#define OLED_FIXED_ASSERT_(w, h)								  \
+	_Static_assert(((w) == OLED_FIXED_WIDTH) && ((h) == OLED_FIXED_HEIGHT),			  \
+		       "OLED_init: size differs from OLED_FIXED_WIDTH x OLED_FIXED_HEIGHT")
+#else
+#define OLED_FIXED_ASSERT_(w, h) _Static_assert(1, "")
+#endif
+
 #ifdef OLED_NO_I2C
 #define OLED_init(o, w, h, fb, ...) ({								  \
 	_Static_assert(!((w) % 8) && !((h) % 8),							  \
 		       "OLED_init: Both width and height MUST BE a multiple of 8");		  \
+	OLED_FIXED_ASSERT_((w), (h));								  \
 	OLED_err __err = __OLED_init((o), (w), (h), (fb), ##__VA_ARGS__);			  \
 	__err; })
+#elif defined(OLED_SPI)
+/* addr is not used by SPI transport, but kept for the same signature */
+#define OLED_init(o, w, h, fb, freq, addr) ({							  \
+	_Static_assert(!((w) % 8) && !((h) % 8),							  \
+		       "OLED_init: Both width and height MUST BE a multiple of 8");		  \
+	OLED_FIXED_ASSERT_((w), (h));								  \
+	_Static_assert((h) <= 8 * OLED_MAX_PAGES,						  \
+		       "OLED_init: height exceeds SSD1306 GDDRAM size");			  \
+	_Static_assert(((freq) >= F_CPU / 128) && ((freq) <= F_CPU / 2),			  \
+		       "OLED_init: SPI hz freq must be in range [F_CPU/128...F_CPU/2]");	  \
+	OLED_err __err = __OLED_init((o), (w), (h), (fb), (freq), (addr));			  \
+	__err; })
 #else
 #define OLED_init(o, w, h, fb, freq, addr) ({							  \
 	_Static_assert(!((w) % 8) && !((h) % 8),							  \
 		       "OLED_init: Both width and height MUST BE a multiple of 8");		  \
+	OLED_FIXED_ASSERT_((w), (h));								  \
+	_Static_assert((h) <= 8 * OLED_MAX_PAGES,						  \
+		       "OLED_init: height exceeds SSD1306 GDDRAM size");			  \
 	_Static_assert(((freq) > F_CPU / 32656 + 1) && ((freq) <= F_CPU / 16),			  \
 		       "OLED_init: I2C hz freq must be in range [1+F_CPU/32656...F_CPU/16]");	  \
 	_Static_assert(((addr) & 0x80) == 0,							  \
@@ -227,37 +461,491 @@ OLED_err __OLED_init(OLED *oled, uint8_t width, uint8_t height, uint8_t *frame_b
 #endif
 
 
+#if !defined(OLED_FIXED_WIDTH)
+/* Off-screen surfaces: an OLED object which is never sent anywhere. Its
+ * frame_buffer has the same page-major layout and is drawn by the same
+ * primitives (clip, viewport and modes included), then blitted into the
+ * display by OLED_composite. Buffers are taken from caller-provided arena,
+ * so sprites could be built without malloc.
+ * Usage example:
+ *	static uint8_t sprites[256];
+ *	OLED_arena arena;
+ *	OLED sprite;
+ *	OLED_arena_init(&arena, sprites, sizeof(sprites));
+ *	OLED_surface_init(&sprite, 32, 16, &arena);
+ *	OLED_put_circle(&sprite, 8, 8, 7, OLED_FILL | OLED_BLACK);
+ *	OLED_composite(&oled, x, y, &sprite, OLED_BLACK);
+ * Not available with OLED_FIXED_WIDTH, as all objects share that geometry
+ */
+typedef struct OLED_arena_s_ {
+	uint8_t *next;		/* First free byte	*/
+	uint16_t left;		/* Free bytes count	*/
+} OLED_arena;
+
+/* OLED_arena_init() - makes arena of buffer
+ * @arena:	arena object
+ * @buffer:	memory surfaces are allocated from
+ * @size:	buffer size in bytes
+ *
+ * Allocations are never freed one by one. Init arena again to reuse the
+ * whole buffer, after surfaces made of it are not used anymore
+ */
+void OLED_arena_init(OLED_arena *arena, uint8_t *buffer, uint16_t size);
+
+/* OLED_surface_init() - makes off-screen surface
+ * @surface:	OLED object to init
+ * @width:	width in pixels, any
+ * @height:	height in pixels, multiple of 8
+ * @arena:	OLED_FB_SIZE(width, height) bytes are taken from it
+ *
+ * Surface is cleared, has no clip, no viewport and no display list. Returns
+ * OLED_EPARAMS if size is invalid, OLED_EBOUNDS if arena is too small
+ *
+ * (!) Warning: surface has no transport, never refresh, lock-wait or
+ *              schedule it. Only draw into it and composite it
+ */
+OLED_err OLED_surface_init(OLED *surface, uint8_t width, uint8_t height, OLED_arena *arena);
+#endif
+
+
 #if !defined(OLED_NO_I2C)
-// TODO: document these
+/* Command batches are built in display's cmdbuffer and sent as one
+ * transaction, using single 0x00 control byte (stream of commands) for all.
+ * Usage example:
+ *	OLED_cmd_begin(&oled);
+ *	OLED_CMDS(&oled, 0x81, 0x7F);	// Contrast
+ *	OLED_CMDS(&oled, 0xA6);		// Normal (non-inverted) display
+ *	OLED_cmd_flush(&oled);
+ * Buffer is owned by display from OLED_cmd_begin till the batch is sent
+ *
+ * Several displays could share one bus: all command scratch is kept per
+ * instance and their transactions are interleaved by the I2C queue
+ */
+
+/* Starts new batch. Uses spinlock, lock is released when batch is sent */
+void OLED_cmd_begin(OLED *oled);
+
+
+/* Appends len command bytes to the batch. Returns OLED_EBOUNDS, appending
+ * nothing, if they do not fit in OLED_CMDBUFFER_LEN
+ */
+OLED_err OLED_cmd_append(OLED *oled, const uint8_t *cmds, uint8_t len);
+
+
+/* Appends command bytes given as arguments */
+#define OLED_CMDS(oled, ...) OLED_cmd_append((oled), (const uint8_t[]){__VA_ARGS__},	\
+					     sizeof((const uint8_t[]){__VA_ARGS__}))
+
+
+/* Sends the batch. Empty batch just releases the lock
+ * On bus errors the whole batch is sent again (twice at most), so it should
+ * not contain commands which give other result when repeated. Lock is
+ * released even if batch could not be sent
+ */
+void OLED_cmd_flush(OLED *oled);
+
 
 /* Sets display brightness. Uses spinlock */
 void OLED_cmd_setbrightness(OLED *oled, uint8_t level);
 
 
-/* Output frame_buffer contents to display. Uses spinlock */
+/* Frames between scroll steps. Values are SSD1306 interval codes */
+enum OLED_scroll_interval {
+	OLED_SCROLL_2FRAMES = 0x07,
+	OLED_SCROLL_3FRAMES = 0x04,
+	OLED_SCROLL_4FRAMES = 0x05,
+	OLED_SCROLL_5FRAMES = 0x00,
+	OLED_SCROLL_25FRAMES = 0x06,
+	OLED_SCROLL_64FRAMES = 0x01,
+	OLED_SCROLL_128FRAMES = 0x02,
+	OLED_SCROLL_256FRAMES = 0x03
+};
+
+enum OLED_scroll_dir {
+	OLED_SCROLL_RIGHT = 0x26,
+	OLED_SCROLL_LEFT = 0x27
+};
+
+
+/* OLED_cmd_scroll() - starts continuous hardware scroll of pages
+ * @oled:	OLED object
+ * @dir:	horizontal direction
+ * @page_from:	first page to scroll
+ * @page_to:	last page to scroll (inclusive)
+ * @interval:	speed
+ * @v_offset:	rows to move up on each step, 0 for horizontal only scroll.
+ *		Vertical scroll area is set to the whole display
+ *
+ * Display scrolls by itself, no data is sent. Refresh should not be done
+ * while scrolling is active. Uses spinlock
+ */
+void OLED_cmd_scroll(OLED *oled, enum OLED_scroll_dir dir, uint8_t page_from, uint8_t page_to,
+		     enum OLED_scroll_interval interval, uint8_t v_offset);
+
+
+/* Stops hardware scroll. As contents of GDDRAM are lost after that, the whole
+ * display is marked dirty, to be resent by the next OLED_refresh_dirty.
+ * Uses spinlock
+ */
+void OLED_cmd_scroll_stop(OLED *oled);
+
+
+/* Sets display start line, i.e. GDDRAM row shown at the top. Uses spinlock */
+void OLED_cmd_setstartline(OLED *oled, uint8_t line);
+
+
+/* OLED_ring_scroll() - scrolls contents up using display start line
+ * @oled:	 OLED object
+ * @rows:	 number of rows to scroll by
+ * @pixel_state: value of pixels in rows exposed at the bottom
+ *
+ * frame_buffer becomes a ring: rows which went off the top are filled and
+ * shown at the bottom, nothing else is moved. Only they are marked dirty,
+ * so scrolling a text terminal by one line costs one page on the next
+ * OLED_refresh_dirty, which sends new start line after the pages.
+ * Draw at OLED_ring_y(oled, y) instead of y to use screen coordinates.
+ * Primitives crossing bottom of frame_buffer are not wrapped, so keep
+ * lines of terminal aligned to page boundaries. Only for 64 rows tall
+ * displays, returns OLED_EPARAMS otherwise
+ *
+ * (!) Notice: method is not atomic. If required, protect it with lock
+ */
+OLED_err OLED_ring_scroll(OLED *oled, uint8_t rows, bool pixel_state);
+
+
+/* Converts screen row to frame_buffer row in ring scroll mode */
+#define OLED_ring_y(oled, y) ((uint8_t)(((y) + (oled)->start_line) & (8 * OLED_MAX_PAGES - 1)))
+
+
+/* Output whole frame_buffer contents to display. Uses spinlock
+ * Display runs in horizontal addressing mode, so frame is streamed as data
+ * alone: a transaction per page for I2C, so that other devices on the bus
+ * get it in between (see OLED_i2c_read), or a single one for SPI. Address
+ * window is reset beforehand only if it was narrowed by OLED_refresh_dirty
+ */
 void OLED_refresh(OLED *oled);
+
+
+/* OLED_refresh_dirty() - output only changed regions of frame_buffer
+ * @oled:	OLED object
+ *
+ * For every page touched by draw routines since the previous refresh only the
+ * span between first and last changed column is sent, preceded by setting the
+ * address window to that span. Pages left untouched are skipped entirely.
+ * Uses spinlock
+ */
+void OLED_refresh_dirty(OLED *oled);
+
+
+/* OLED_refresh_async() - start refresh if display is not busy, do not wait
+ * @oled:	OLED object
+ * @only_dirty:	send only changed regions as OLED_refresh_dirty does, or
+ *		the whole frame_buffer as OLED_refresh does
+ * @end_cbk:	called when the last page is sent and lock is released.
+ *		Called from ISR context and must be short. Could be NULL
+ * @cbk_args:	passed to end_cbk along with OLED_EOK, or with error code if
+ *		some transfer failed and refresh was aborted
+ *
+ * Returns OLED_EBUSY immediately if previous transaction is not finished.
+ * Refresh started from a callback (e.g. of another display's refresh) is
+ * aborted with OLED_EBUSY passed to end_cbk when transport queue is full,
+ * as it can not wait for a slot there. After aborted refresh address
+ * window of display is not known, so the next full refresh sets it again.
+ * Dirty regions which were not sent are lost, so use OLED_refresh
+ * afterwards to resync the display
+ */
+OLED_err OLED_refresh_async(OLED *oled, bool only_dirty, void (*end_cbk)(void *, OLED_err), void *cbk_args);
+
+
+/* OLED_tick() - drives transfer timeout
+ *
+ * Should be called periodically, e.g. each millisecond from timer ISR.
+ * I2C transfer which made no progress for OLED_I2C_TIMEOUT_TICKS ticks is
+ * aborted: bus is recovered by clocking SCL until slave releases SDA and
+ * transaction callback gets OLED_ETIMEOUT, so the lock is released.
+ * Timeout is not checked at all if it is never called. Does nothing for SPI
+ */
+void OLED_tick(void);
+
+
+#if !defined(OLED_SPI)
+/* Other devices may share the I2C bus of displays. Their transactions go to
+ * the same queue as page writes of displays, which are a page long at most.
+ * So priority transaction waits for a page (~6 ms at 200 kHz) instead of
+ * the whole frame. Buffers must stay valid till end_cbk is called from ISR
+ * context with OLED_EOK or error code. Transactions are not retried on
+ * errors, as it may not be safe for the device. They return OLED_EBUSY if
+ * the queue is full instead of waiting, so could be called from callbacks
+ */
+
+/* Sets up TWI for devices which are used before display init. Bus frequency
+ * is set only by the first of OLED_i2c_init and OLED_init calls
+ */
+void OLED_i2c_init(uint32_t hz_freq);
+
+
+/* OLED_i2c_write() - queues write transaction
+ * @addr:	 7-bit device address
+ * @prefix:	 bytes sent first, e.g. register address. Could be NULL
+ * @prefix_len:	 number of bytes in prefix
+ * @bytes:	 bytes sent after prefix in the same transaction. Could be NULL
+ * @len:	 number of bytes in bytes
+ * @end_cbk:	 called when transaction is over. Could be NULL
+ * @cbk_args:	 passed to end_cbk along with error code
+ * @is_priority: put right after the transaction being sent, ahead of the
+ *		 ones queued by displays and other writes and reads
+ */
+OLED_err OLED_i2c_write(uint8_t addr, uint8_t *prefix, uint8_t prefix_len, uint8_t *bytes,
+			uint16_t len, void (*end_cbk)(void *, OLED_err), void *cbk_args,
+			bool is_priority);
+
+
+/* OLED_i2c_read() - queues read transaction
+ * @addr:	 7-bit device address
+ * @reg:	 bytes written first, e.g. register address. Followed by
+ *		 repeated START and read. Could be NULL for plain read
+ * @reg_len:	 number of bytes in reg
+ * @bytes:	 where len bytes are received to. The last one is NACKed
+ * @len:	 number of bytes to read
+ * @end_cbk:	 called when transaction is over. Could be NULL
+ * @cbk_args:	 passed to end_cbk along with error code
+ * @is_priority: see OLED_i2c_write
+ */
+OLED_err OLED_i2c_read(uint8_t addr, uint8_t *reg, uint8_t reg_len, uint8_t *bytes,
+		       uint16_t len, void (*end_cbk)(void *, OLED_err), void *cbk_args,
+		       bool is_priority);
 #endif
 
-/* Inline put pixel, without checks. See the full method below		     */
-/* Used to allow GCC to optimize other draw routines which use put_pixel     */
-inline ALWAYSINLINE void OLED_put_pixel_(OLED *oled, uint8_t x, uint8_t y, bool pixel_state)
+
+/* OLED_refresh_request() - schedules refresh instead of waiting for display
+ * @oled:	OLED object
+ * @only_dirty:	send only changed regions as OLED_refresh_dirty does, or
+ *		the whole frame_buffer as OLED_refresh does
+ *
+ * Refresh starts at once if display is not busy and frame interval (see
+ * OLED_set_frame_ticks) is over. Otherwise it is left pending, to be started
+ * by a later request or by OLED_refresh_poll. Requests made meanwhile are
+ * coalesced into that single refresh: dirty one sends everything drawn till
+ * it starts, and full request takes over dirty ones. Completion is not
+ * reported, poll OLED_is_busy.
+ * Scheduled refresh is started only here and in OLED_refresh_poll, never
+ * from interrupts, as taking dirty spans and swapping buffers must not cut
+ * into a draw routine. So lock-free drawing of double-buffered mode stays
+ * safe. May spin while transport queue is full, so do not call from
+ * interrupts
+ */
+void OLED_refresh_request(OLED *oled, bool only_dirty);
+
+
+/* OLED_refresh_poll() - starts pending scheduled refresh
+ * @oled:	OLED object
+ *
+ * Should be called from the main loop, e.g. each pass. Pending refresh is
+ * started if display is not busy and frame interval is over, otherwise it
+ * is left for the next poll. Does nothing if no refresh is pending.
+ * May spin while transport queue is full, so do not call from interrupts
+ */
+void OLED_refresh_poll(OLED *oled);
+
+
+/* OLED_set_frame_ticks() - limits rate of refreshes started by scheduler
+ * @oled:	OLED object
+ * @ticks:	minimum number of OLED_refresh_tick calls between starts of
+ *		two refreshes scheduled by OLED_refresh_request. 0 (default)
+ *		starts them as soon as display is free
+ *
+ * E.g. 40 with tick each millisecond caps display at 25 FPS, leaving the bus
+ * to other traffic. OLED_refresh and friends are not limited
+ */
+void OLED_set_frame_ticks(OLED *oled, uint8_t ticks);
+
+
+/* OLED_refresh_tick() - drives frame rate limiter of the display
+ * @oled:	OLED object
+ *
+ * Should be called periodically, e.g. along with OLED_tick from timer ISR.
+ * Only counts the frame interval down. Pending refresh is started by the
+ * next OLED_refresh_poll after it is over
+ */
+void OLED_refresh_tick(OLED *oled);
+
+
+/* Tries to output whole frame_buffer. Returns OLED_EBUSY instead of spinning */
+#define OLED_try_refresh(oled) OLED_refresh_async((oled), false, NULL, NULL)
+
+
+/* OLED_set_doublebuffer() - enables or disables double-buffered mode
+ * @oled:	 OLED object
+ * @back_buffer: second buffer of the same size as frame_buffer or NULL to
+ *		 return to single-buffered mode
+ *
+ * In double-buffered mode refresh hands buffer which was drawn to the page
+ * callbacks and switches frame_buffer to the other one, so drawing continues
+ * immediately, while previous frame is being streamed. Only spans changed
+ * since previous refresh are copied between buffers on each swap. Front
+ * buffer is released when the last page callback fires.
+ * Draw routines do not need to be protected with lock in this mode, but
+ * frame_buffer pointer changes on each refresh, so do not cache it.
+ * Uses spinlock
+ */
+OLED_err OLED_set_doublebuffer(OLED *oled, uint8_t *back_buffer);
+
+
+/* OLED_set_render() - enables or disables bufferless (page render) mode
+ * @oled:	 OLED object
+ * @page_buffer: scratch buffer of width bytes, i.e. one page
+ * @render:	 fills page_buffer with page contents: render(args, page, buf).
+ *		 NULL returns to frame_buffer mode
+ * @args:	 passed to render
+ *
+ * In this mode frame_buffer is not used at all and could be NULL at init,
+ * so 128x64 display needs 128 bytes of RAM instead of 1024. Refresh calls
+ * render for each page right before sending it, from ISR context. Bus is
+ * idle while the page is rendered, so render time adds to refresh time.
+ * Buffer contents are in GDDRAM layout: byte per column, LSB at the top.
+ * OLED_refresh renders and sends all pages. OLED_refresh_dirty renders only
+ * pages marked with OLED_mark_dirty_() and sends their dirty spans.
+ * Draw routines work on frame_buffer and must not be used in this mode.
+ * Uses spinlock
+ */
+OLED_err OLED_set_render(OLED *oled, uint8_t *page_buffer, void (*render)(void *, uint8_t, uint8_t *), void *args);
+
+
+/* OLED_set_dlist() - enables or disables display list mode
+ * @oled:	 OLED object
+ * @page_buffer: scratch buffer of width bytes, i.e. one page
+ * @list:	 buffer for records of draw calls. NULL returns to
+ *		 frame_buffer mode
+ * @list_size:	 size of list in bytes
+ *
+ * Bufferless mode (see OLED_set_render), where OLED_put_pixel,
+ * OLED_put_rectangle, OLED_put_roundRect, OLED_put_line, OLED_put_circle,
+ * OLED_put_ellipse, OLED_put_bitmap(_P), OLED_put_rle_P and OLED_put_text(_P)
+ * / OLED_put_char are not drawn, but appended to the list as records of 8-10
+ * bytes. Each record is binned by pages of its bounding box, which is marked
+ * dirty.
+ * Refresh rasterizes records of each page right before it is sent, in order
+ * they were made, so primitives overlap the same way as in frame_buffer.
+ * Pages no record touches are only cleared.
+ * OLED_fill_screen empties the list and sets the color pages are cleared
+ * with, so scene is usually redrawn as:
+ * OLED_fill_screen(&oled, 0);
+ * OLED_put_rectangle(&oled, ...); ...
+ * OLED_refresh_dirty(&oled);
+ * Changes of clip and origin are recorded too, records are rendered with
+ * the ones they were made with. Strings from RAM are copied into the list,
+ * while PROGMEM strings, fonts and bitmaps are referenced and must stay
+ * valid. Draw calls return OLED_EBOUNDS when the record does not fit.
+ * Inline OLED_put_pixel_ and OLED_fill_span_ must not be used in this mode.
+ * Not atomic: do not draw while refresh is running, e.g. with
+ * OLED_WITH_SPINLOCK. Uses spinlock
+ */
+OLED_err OLED_set_dlist(OLED *oled, uint8_t *page_buffer, uint8_t *list, uint16_t list_size);
+#endif
+
+
+/* Marks columns [x_from..x_to] of pages [page_from..page_to] as changed, so
+ * that they are sent by OLED_refresh_dirty. No checks, arguments must be
+ * normalized (from <= to) and lie inside display bounds.
+ * Call it after modifying frame_buffer contents directly
+ */
+inline ALWAYSINLINE void OLED_mark_dirty_(OLED *oled, uint8_t x_from, uint8_t x_to,
+					  uint8_t page_from, uint8_t page_to)
+{
+#if !defined(OLED_NO_I2C)
+	for (uint8_t page = page_from; page <= page_to; page++) {
+		uint8_t mask = 1 << page;
+		if (!(oled->dirty_pages & mask)) {
+			oled->dirty_pages |= mask;
+			oled->dirty_from[page] = x_from;
+			oled->dirty_to[page] = x_to;
+			continue;
+		}
+		if (x_from < oled->dirty_from[page])
+			oled->dirty_from[page] = x_from;
+		if (x_to > oled->dirty_to[page])
+			oled->dirty_to[page] = x_to;
+	}
+#else
+	(void)oled; (void)x_from; (void)x_to; (void)page_from; (void)page_to;
+#endif
+}
+
+
+/* Inline put pixel into frame_buffer, without checks and dirty tracking     */
+/* Used by draw routines which mark the whole area they touch at once	     */
+/* pixel_state is 0, 1 or OLED_XOR to invert the pixel			     */
+inline ALWAYSINLINE void OLED_fb_pixel_(OLED *oled, uint8_t x, uint8_t y, uint8_t pixel_state)
 {
 	/* Find byte index in flat array */
-	uint16_t byte_num = (y / 8) * (uint16_t)oled->width + x;
+	uint16_t byte_num = (y / 8) * (uint16_t)OLED_WIDTH(oled) + x;
 	uint8_t bit_y = y % 8;
-	if (pixel_state)
+	OLED_PROFWRAP(OLED_prof_data.pixels++;)
+	if (OLED_XOR == pixel_state)
+		oled->frame_buffer[byte_num] ^= (1 << bit_y);
+	else if (pixel_state)
 		oled->frame_buffer[byte_num] |= (1 << bit_y);
 	else
 		oled->frame_buffer[byte_num] &= ~(1 << bit_y);
 }
 
 
+/* Inline put pixel, without checks. See the full method below		     */
+/* Used to allow GCC to optimize other draw routines which use put_pixel     */
+inline ALWAYSINLINE void OLED_put_pixel_(OLED *oled, uint8_t x, uint8_t y, uint8_t pixel_state)
+{
+	OLED_fb_pixel_(oled, x, y, pixel_state);
+	OLED_mark_dirty_(oled, x, x, y / 8, y / 8);
+}
+
+
+/* OLED_set_clip() - limits draw routines to the rectangle
+ * @oled:	OLED object
+ * @x_from:	first corner horizontal coordinate
+ * @y_from:	first corner vertical coordinate
+ * @x_to:	opposite corner horizontal coordinate (inclusive)
+ * @y_to:	opposite corner vertical coordinate (inclusive)
+ *
+ * Coordinates are display ones, origin is not applied to them. Rectangle is
+ * limited to display bounds. Each primitive clips its bounding box, spans and
+ * image columns against it once, so pixels outside are never written and not
+ * marked dirty. Only Bresenham lines crossing the edge check their pixels.
+ * Inline OLED_put_pixel_ and OLED_fb_pixel_, as well as OLED_fill_screen
+ * and OLED_ring_scroll, ignore the clip.
+ * Returns OLED_EBOUNDS if rectangle is out of display bounds or display list
+ * is full, the clip is not changed then
+ */
+OLED_err OLED_set_clip(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to);
+
+/* OLED_set_origin() - translates coordinates of draw routines
+ * @oled:	OLED object
+ * @x:		display column of horizontal coordinate 0
+ * @y:		display row of vertical coordinate 0
+ *
+ * Origin is added to coordinates given to OLED_put_* routines (but not to
+ * inline ones and OLED_fill_span_), so widget can be drawn anywhere with
+ * coordinates relative to its corner. Points which end up outside display
+ * are clipped. Returns OLED_EBOUNDS if display list is full
+ */
+OLED_err OLED_set_origin(OLED *oled, uint8_t x, uint8_t y);
+
+/* OLED_set_viewport() - sets clip to the rectangle and origin to its upper
+ * left corner, so a pane is drawn with its own coordinates and can not
+ * touch anything outside. See OLED_set_clip
+ */
+OLED_err OLED_set_viewport(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to);
+
+/* Returns clip to the whole display and origin to (0, 0) */
+OLED_err OLED_reset_viewport(OLED *oled);
+
+
 /* OLED_put_pixel() - puts pixel at specified coordinates
  * @oled:	OLED object
  * @x:		horizonal coordinate (starting at 0, left-to-right)
  * @y:		vertical coordinate (starting at 0, top-to-bottom)
- * @pixel_state	value of the pixel (0 or 1)
+ * @pixel_state	value of the pixel (0 or 1), or OLED_XOR to invert it
  *
+ * Pixel outside clip rectangle is not drawn, OLED_EBOUNDS is returned then.
  * Use inline OLED_put_pixel_ for faster output, but without checks
  *
  * These methods are not atomic. If required, protect them with lock, i.e.:
@@ -267,7 +955,34 @@ inline ALWAYSINLINE void OLED_put_pixel_(OLED *oled, uint8_t x, uint8_t y, bool
  * 	OLED_put_pixel(&oled, 10, 20, 1);
  * }
  */
-OLED_err OLED_put_pixel(OLED *oled, uint8_t x, uint8_t y, bool pixel_state);
+OLED_err OLED_put_pixel(OLED *oled, uint8_t x, uint8_t y, uint8_t pixel_state);
+
+
+/* OLED_fill_span_() - sets or clears every pixel of the area
+ * @oled:	OLED object
+ * @x_from:	left column
+ * @y_from:	top row
+ * @x_to:	right column (x_from <= x_to)
+ * @y_to:	bottom row (y_from <= y_to)
+ * @pixel_state	value of the pixels (0 or 1), or OLED_XOR to invert them
+ *
+ * Operates on whole page bytes: pages fully covered by the area are written
+ * with memset, partially covered top and bottom pages are masked once and the
+ * mask is applied across the column run. Horizontal and vertical lines are the
+ * degenerate cases with y_from == y_to or x_from == x_to.
+ * Area is limited to clip rectangle once, origin is not applied to it.
+ * Area is marked as dirty at once.
+ */
+void OLED_fill_span_(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, uint8_t pixel_state);
+
+
+/* OLED_fill_screen() - sets or clears all pixels of the frame_buffer
+ * @oled:	OLED object
+ * @pixel_state	value of the pixels (0 or 1)
+ *
+ * Clip rectangle does not apply, fill rectangle to clear a pane
+ */
+void OLED_fill_screen(OLED *oled, bool pixel_state);
 
 
 /* OLED_put_rectangle() - ...
@@ -277,6 +992,205 @@ OLED_err OLED_put_pixel(OLED *oled, uint8_t x, uint8_t y, bool pixel_state);
  */
 OLED_err OLED_put_rectangle(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, enum OLED_params params);
 
+/* OLED_invert_region() - inverts pixels of the rectangle
+ * @oled:	OLED object
+ * @x_from:	first corner horizontal coordinate
+ * @y_from:	first corner vertical coordinate
+ * @x_to:	opposite corner horizontal coordinate (inclusive)
+ * @y_to:	opposite corner vertical coordinate (inclusive)
+ *
+ * Same as OLED_put_rectangle with OLED_FILL | OLED_XOR: page bytes of the
+ * area are XORed in place with one mask per page, and only the area is
+ * marked dirty. Calling it twice restores the contents, so selection or
+ * cursor is moved without redrawing what is under it
+ */
+OLED_err OLED_invert_region(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to);
+
+/* OLED_put_line() - draws a line between two points (both inclusive)
+ * @oled:	OLED object
+ * @x_from:	first point horizontal coordinate
+ * @y_from:	first point vertical coordinate
+ * @x_to:	second point horizontal coordinate
+ * @y_to:	second point vertical coordinate
+ * @params:	color or OLED_XOR. OLED_FILL has no effect on lines
+ *
+ * Vertical and horizontal lines are clipped and drawn with page-byte spans.
+ * Other lines use integer Bresenham algorithm. Pixels are checked only if
+ * the line crosses clip rectangle edge, walk ends once it leaves the clip.
+ * Returns OLED_EBOUNDS if bounding box is outside of clip rectangle
+ *
+ * (!) Notice: method is not atomic. If required, protect it with lock
+ */
+OLED_err OLED_put_line(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, enum OLED_params params);
+
+
+/* OLED_put_circle() - draws circle
+ * @oled:	OLED object
+ * @x0:		center horizontal coordinate, may lie outside of display
+ * @y0:		center vertical coordinate, may lie outside of display
+ * @r:		radius. Circle is 2 * r + 1 pixels wide
+ * @params:	color or OLED_XOR, and fill
+ *
+ * Filled circle is drawn as vertical spans of page bytes, each column once.
+ * Circle is clipped by clip rectangle, with checks done once per span or
+ * skipped for outlines lying fully inside. Returns OLED_EBOUNDS if circle
+ * is outside of clip rectangle
+ *
+ * (!) Notice: method is not atomic. If required, protect it with lock
+ */
+OLED_err OLED_put_circle(OLED *oled, int16_t x0, int16_t y0, uint8_t r, enum OLED_params params);
+
+/* Draws ellipse with horizontal radius rx and vertical one ry. Same as
+ * OLED_put_circle otherwise
+ */
+OLED_err OLED_put_ellipse(OLED *oled, int16_t x0, int16_t y0, uint8_t rx, uint8_t ry, enum OLED_params params);
+
+
+/* OLED_put_roundRect() - draws rectangle with rounded corners
+ * @oled:	OLED object
+ * @x_from:	first corner horizontal coordinate
+ * @y_from:	first corner vertical coordinate
+ * @x_to:	opposite corner horizontal coordinate (inclusive)
+ * @y_to:	opposite corner vertical coordinate (inclusive)
+ * @r:		corner radius, limited to half of the shorter side
+ * @params:	color or OLED_XOR, and fill
+ *
+ * Corners are the same as for OLED_put_rectangle. Fill is a single span
+ * between corner arcs plus one vertical span per arc column, outline is
+ * arcs joined by straight spans, so each pixel is drawn once. Shape is
+ * clipped by clip rectangle. Returns OLED_EBOUNDS if it is outside of it
+ *
+ * (!) Notice: method is not atomic. If required, protect it with lock
+ */
 OLED_err OLED_put_roundRect(OLED *oled, uint8_t x_from, uint8_t y_from, uint8_t x_to, uint8_t y_to, uint8_t r, enum OLED_params params);
-OLED_err fillCircleHelper(OLED *oled, int16_t x0, int16_t y0, int16_t r,uint8_t cornername, int16_t delta, enum OLED_params params);
-OLED_err drawCircleHelper(OLED *oled, int16_t x0, int16_t y0, int16_t r, uint8_t cornername, enum OLED_params params);
\ No newline at end of file
+
+
+/* OLED_put_bitmap() - draws image
+ * @oled:	OLED object
+ * @x:		left coordinate
+ * @y:		top coordinate, any (not only page aligned)
+ * @w:		image width in pixels
+ * @h:		image height in pixels
+ * @bitmap:	image in GDDRAM layout: (h + 7) / 8 pages of w column bytes,
+ *		LSB being the top pixel. Bits below h in the last page are
+ *		ignored
+ * @params:	mode:
+ *		OLED_FILL | color - image replaces the area, set bits are
+ *				    drawn with color, clear ones with opposite
+ *		color		  - only set bits are drawn with color, others
+ *				    are transparent
+ *		OLED_XOR	  - set bits invert pixels
+ *
+ * Image drawn at page-aligned y with OLED_FILL | OLED_BLACK is copied with
+ * memcpy. Image is clipped by clip rectangle, the drawn area is marked as
+ * dirty. Returns OLED_EBOUNDS if image is outside of clip rectangle,
+ * OLED_EPARAMS if image is empty or params are invalid
+ *
+ * (!) Notice: method is not atomic. If required, protect it with lock
+ */
+OLED_err OLED_put_bitmap(OLED *oled, uint8_t x, uint8_t y, uint8_t w, uint8_t h, const uint8_t *bitmap, enum OLED_params params);
+
+/* Same as OLED_put_bitmap, but bitmap is stored in flash (PROGMEM) */
+OLED_err OLED_put_bitmap_P(OLED *oled, uint8_t x, uint8_t y, uint8_t w, uint8_t h, const uint8_t *bitmap, enum OLED_params params);
+
+
+/* OLED_put_rle_P() - draws run-length compressed image stored in flash
+ * @oled:	OLED object
+ * @x:		left coordinate
+ * @y:		top coordinate, any (not only page aligned)
+ * @image:	image made by tools/oled_rle.py (PROGMEM)
+ * @params:	mode, the same as for OLED_put_bitmap
+ *
+ * Image is GDDRAM layout of OLED_put_bitmap, compressed page by page:
+ * width, height, then for each page little-endian offset of its runs from
+ * the image start, followed by the runs. Control byte 0x00-0x7F is followed
+ * by that many plus one literal bytes, 0x80-0xFF by a byte repeated
+ * (ctrl & 0x7F) + 3 times. Runs do not cross pages.
+ * At page-aligned y with OLED_FILL | OLED_BLACK pages are expanded straight
+ * into frame_buffer, so blank runs cost a memset. Other cases go through
+ * the bitmap blitter in chunks of 16 columns. Clipping, dirty marking and
+ * return codes are the same as for OLED_put_bitmap
+ *
+ * (!) Notice: method is not atomic. If required, protect it with lock
+ */
+OLED_err OLED_put_rle_P(OLED *oled, uint8_t x, uint8_t y, const uint8_t *image, enum OLED_params params);
+
+
+/* OLED_rle_page_P() - expands one page of compressed image
+ * @image:	image made by tools/oled_rle.py (PROGMEM)
+ * @page:	page of the image
+ * @buf:	where image width bytes are written to
+ *
+ * For render callbacks of bufferless mode (see OLED_set_render): page of a
+ * display wide image is expanded right into the page buffer being sent.
+ * Returns OLED_EPARAMS if image has no such page
+ */
+OLED_err OLED_rle_page_P(const uint8_t *image, uint8_t page, uint8_t *buf);
+
+
+#if !defined(OLED_FIXED_WIDTH)
+/* OLED_composite() - draws off-screen surface (see OLED_surface_init)
+ * @oled:	OLED object to draw into
+ * @x:		left coordinate
+ * @y:		top coordinate, any (not only page aligned)
+ * @surface:	surface to draw
+ * @params:	mode, the same as for OLED_put_bitmap
+ *
+ * Surface buffer is drawn as OLED_put_bitmap: each page is shifted by
+ * y % 8 and merged into two pages of destination with a mask, whole column
+ * bytes at a time. Surface's own clip and viewport do not matter. Clipping,
+ * dirty marking and return codes are the same as for OLED_put_bitmap.
+ * In display list mode the surface buffer is referenced, so it must not
+ * change until the list is rendered
+ *
+ * (!) Notice: method is not atomic. If required, protect it with lock
+ */
+OLED_err OLED_composite(OLED *oled, uint8_t x, uint8_t y, const OLED *surface, enum OLED_params params);
+#endif
+
+
+/* Fonts are stored in flash in GDDRAM layout: each glyph is `pages` rows of
+ * `width` column bytes, LSB being the top pixel. So glyph drawn at y which is
+ * a multiple of 8 is copied byte by byte, otherwise each byte is split
+ * between two pages with a single multiplication
+ */
+typedef struct OLED_font_s_ {
+	const uint8_t *glyphs;	/* PROGMEM array, glyphs of chars first..last */
+	uint8_t width;		/* Glyph width in columns		      */
+	uint8_t pages;		/* Glyph height in pages (8 pixels each)      */
+	uint8_t spacing;	/* Empty columns after each glyph	      */
+	char first;
+	char last;
+} OLED_font;
+
+/* 5x7 font for printable ASCII, 6 columns per char with spacing */
+extern const OLED_font OLED_font5x7;
+
+/* Width in pixels of n chars printed with font */
+#define OLED_TEXT_WIDTH(font, n) ((n) * ((font)->width + (font)->spacing))
+
+
+/* OLED_put_text() - draws string using font
+ * @oled:	OLED object
+ * @x:		left coordinate of the first char
+ * @y:		top coordinate of the first char, any (not only page aligned)
+ * @font:	font to use
+ * @str:	zero-terminated string. '\n' moves to the next line at x. Chars
+ *		missing in font are drawn as the font's first char
+ * @params:	color. With OLED_FILL the whole char cell, including spacing,
+ *		is drawn, i.e. background is set to the opposite color.
+ *		Otherwise only glyph pixels are drawn over what is there.
+ *		With OLED_XOR glyph pixels invert what is there
+ *
+ * Text is clipped by clip rectangle. Returns OLED_EBOUNDS if it starts right
+ * of or below the clip rectangle, OLED_EPARAMS if params are invalid
+ *
+ * (!) Notice: method is not atomic. If required, protect it with lock
+ */
+OLED_err OLED_put_text(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font, const char *str, enum OLED_params params);
+
+/* Same as OLED_put_text, but str is stored in flash, e.g. PSTR("text") */
+OLED_err OLED_put_text_P(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font, const char *str, enum OLED_params params);
+
+/* Draws a single char. See OLED_put_text */
+OLED_err OLED_put_char(OLED *oled, uint8_t x, uint8_t y, const OLED_font *font, char c, enum OLED_params params);
@@ -0,0 +1,275 @@
+#define F_CPU 16000000UL
+
+#include "oled.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Benchmark of draw primitives and refresh. Runs on the real MCU or under
+ * simavr (see `make bench`). Results are printed to USART0 at 115200 baud.
+ * Cycles are counted by Timer1 running at F_CPU, extended to 32 bits by
+ * its overflow interrupt. Everything else runs with interrupts enabled, so
+ * draw timings include TWI interrupts only if a refresh is in progress,
+ * which is avoided below.
+ * simavr has no display on the bus, so lib is built with OLED_I2C_IGNORE_NACK
+ * and refresh sends all of its bytes, as it would to a real display.
+ */
+
+#define BENCH_BAUD 115200UL
+
+static volatile uint16_t t1_overflows;
+
+ISR(TIMER1_OVF_vect)
+{
+  t1_overflows++;
+}
+
+static uint32_t cycles_now(void)
+{
+  uint16_t hi, lo;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    lo = TCNT1;
+    hi = t1_overflows;
+    /* Overflow happened, but was not serviced yet */
+    if ((TIFR1 & (1 << TOV1)) && (lo < 0x8000))
+      hi++;
+  }
+  return ((uint32_t)hi << 16) | lo;
+}
+
+static int uart_putchar(char c, FILE *stream)
+{
+  (void)stream;
+  if ('\n' == c)
+    uart_putchar('\r', stream);
+  while (!(UCSR0A & (1 << UDRE0)));
+  UDR0 = c;
+  return 0;
+}
+
+static FILE uart_out = FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
+
+static void bench_init(void)
+{
+  /* USART0, 8N1, double speed */
+  UCSR0A = (1 << U2X0);
+  UBRR0 = F_CPU / (8 * BENCH_BAUD) - 1;
+  UCSR0B = (1 << TXEN0);
+  UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+  stdout = &uart_out;
+
+  /* Timer1, normal mode, no prescaling */
+  TCCR1A = 0;
+  TCCR1B = (1 << CS10);
+  TIMSK1 = (1 << TOIE1);
+}
+
+static uint32_t overhead;
+
+/* 32x32 image, contents do not matter for timing */
+static const uint8_t bench_icon[4 * 32] PROGMEM = {0x55, 0xAA};
+
+/* 128x64 compressed image (see tools/oled_rle.py), each page is a blank run */
+static const uint8_t bench_splash[] PROGMEM = {
+  128, 64, 18, 0, 20, 0, 22, 0, 24, 0, 26, 0, 28, 0, 30, 0, 32, 0,
+  0xFD, 0x00, 0xFD, 0x00, 0xFD, 0x00, 0xFD, 0x00,
+  0xFD, 0x00, 0xFD, 0x00, 0xFD, 0x00, 0xFD, 0x00
+};
+
+#if defined(OLED_PROFILE)
+/* Built by `make bench-profile`: counters of the lib are printed too. */
+/* They are read outside of timed regions                              */
+static OLED_prof prof;
+
+static void prof_print(void)
+{
+  OLED_prof_read(&prof, true);
+  printf("%-28s %10lu pixels %6lu bytes %4u tx %2u pages %8lu isr %8lu lock\n", "",
+         prof.pixels, prof.bytes, prof.transactions, prof.pages,
+         prof.isr_ticks, prof.lock_ticks);
+}
+#else
+static void prof_print(void)
+{
+}
+#endif
+
+/* Runs STMT `n` times and prints average cycles per run (loop included) */
+/* Run index is available to STMT as `i`                                  */
+#define BENCH(name, n, STMT) do {                                     \
+    OLED_PROFWRAP(OLED_prof_read(NULL, true);)                        \
+    uint32_t __start = cycles_now();                                  \
+    for (uint16_t i = 0; i < (n); i++) {                              \
+      STMT;                                                           \
+    }                                                                 \
+    uint32_t __cycles = (cycles_now() - __start - overhead) / (n);   \
+    printf("%-28s %10lu cycles\n", (name), __cycles);                 \
+    prof_print();                                                     \
+  } while (0)
+
+static volatile bool is_refreshed;
+static volatile uint32_t refresh_end;
+static volatile OLED_err refresh_err;
+
+static void refresh_done(void *args, OLED_err err)
+{
+  (void)args;
+  refresh_err = err;
+  refresh_end = cycles_now();
+  is_refreshed = true;
+}
+
+/* Measures time of the call itself and time till the last page is sent */
+static void bench_refresh(const char *name, bool only_dirty, OLED *oled)
+{
+  while (OLED_is_busy(oled));
+  is_refreshed = false;
+  OLED_PROFWRAP(OLED_prof_read(NULL, true);)
+  uint32_t start = cycles_now();
+  OLED_refresh_async(oled, only_dirty, &refresh_done, NULL);
+  uint32_t ret = cycles_now();
+  while (!is_refreshed);
+  printf("%-28s %10lu cycles call, %10lu cycles total", name,
+         ret - start - overhead, refresh_end - start - overhead);
+  /* Bench lib ignores NACKs (see BENCH_FLAGS), so any error is a real one */
+  if (OLED_EOK != refresh_err)
+    printf(" (error %d)", refresh_err);
+  printf("\n");
+  prof_print();
+}
+
+static bool fb_pixel(const uint8_t *fb, uint8_t x, uint8_t y)
+{
+  return (fb[(y / 8) * 128 + x] >> (y % 8)) & 1;
+}
+
+/* Thin ellipses must reach cx +- rx on the axis and cy +- ry at the top and */
+/* bottom, and nothing beyond                                               */
+static bool ellipse_extents_ok(OLED *oled, const uint8_t *fb)
+{
+  const uint8_t cx = 64, cy = 32;
+  for (uint8_t ry = 1; ry <= 4; ry++) {
+    for (uint8_t rx = ry; rx <= 60; rx++) {
+      for (uint8_t fill = 0; fill <= OLED_FILL; fill += OLED_FILL) {
+        OLED_fill_screen(oled, 0);
+        OLED_put_ellipse(oled, cx, cy, rx, ry, fill | 1);
+        if (!fb_pixel(fb, cx - rx, cy) || !fb_pixel(fb, cx + rx, cy)
+            || !fb_pixel(fb, cx, cy - ry) || !fb_pixel(fb, cx, cy + ry))
+          return false;
+        for (uint8_t y = cy - ry - 1; y <= cy + ry + 1; y++)
+          if (fb_pixel(fb, cx - rx - 1, y) || fb_pixel(fb, cx + rx + 1, y))
+            return false;
+        for (uint8_t x = cx - rx; x <= cx + rx; x++)
+          if (fb_pixel(fb, x, cy - ry - 1) || fb_pixel(fb, x, cy + ry + 1))
+            return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  bench_init();
+  sei();
+
+  OLED oled;
+  uint8_t fb[1024] = {0};
+  OLED_init(&oled, 128, 64, fb, 400000, 0b0111100);
+  while (OLED_is_busy(&oled));
+
+  /* Calibrate timer read overhead */
+  overhead = 0;
+  uint32_t start = cycles_now();
+  overhead = cycles_now() - start;
+
+  printf("\nOLED benchmark, F_CPU=%lu\n", F_CPU);
+  BENCH("OLED_put_pixel", 512, OLED_put_pixel(&oled, i % 128, i % 64, 1));
+  BENCH("OLED_fill_screen", 16, OLED_fill_screen(&oled, 0));
+  BENCH("OLED_put_rectangle fill", 16, OLED_put_rectangle(&oled, 0, 0, 127, 63, OLED_FILL | 1));
+  BENCH("OLED_put_rectangle 10x10", 64, OLED_put_rectangle(&oled, 3, 3, 12, 12, OLED_FILL | 1));
+  BENCH("OLED_put_rectangle frame", 64, OLED_put_rectangle(&oled, 0, 0, 127, 63, 1));
+  BENCH("OLED_put_line diagonal", 64, OLED_put_line(&oled, 0, 0, 127, 63, 1));
+  BENCH("OLED_put_line vertical", 64, OLED_put_line(&oled, 5, 0, 5, 63, 1));
+  BENCH("OLED_put_line diagonal XOR", 64, OLED_put_line(&oled, 0, 0, 127, 63, OLED_XOR));
+  BENCH("OLED_invert_region 64x16", 64, OLED_invert_region(&oled, 32, 20, 95, 35));
+  BENCH("OLED_put_roundRect fill", 16, OLED_put_roundRect(&oled, 10, 10, 40, 20, 5, OLED_FILL | 0));
+  BENCH("OLED_put_roundRect frame", 16, OLED_put_roundRect(&oled, 14, 14, 90, 25, 7, 0));
+  BENCH("OLED_put_roundRect 60x30 fill", 16, OLED_put_roundRect(&oled, 20, 20, 79, 49, 6, OLED_FILL | 1));
+  BENCH("OLED_put_circle r=20", 16, OLED_put_circle(&oled, 64, 32, 20, 1));
+  BENCH("OLED_put_circle r=20 fill", 16, OLED_put_circle(&oled, 64, 32, 20, OLED_FILL | 1));
+  BENCH("OLED_put_circle r=40 clipped", 16, OLED_put_circle(&oled, 64, 32, 40, 1));
+  BENCH("OLED_put_ellipse 30x20 fill", 16, OLED_put_ellipse(&oled, 64, 32, 30, 20, OLED_FILL | 1));
+  BENCH("OLED_put_bitmap_P 32x32 aligned", 16,
+        OLED_put_bitmap_P(&oled, 8, 16, 32, 32, bench_icon, OLED_FILL | 1));
+  BENCH("OLED_put_bitmap_P 32x32 unaligned", 16,
+        OLED_put_bitmap_P(&oled, 8, 19, 32, 32, bench_icon, OLED_FILL | 1));
+  BENCH("OLED_put_bitmap_P 32x32 XOR", 16,
+        OLED_put_bitmap_P(&oled, 8, 19, 32, 32, bench_icon, OLED_XOR));
+  BENCH("OLED_put_rle_P 128x64 aligned", 16,
+        OLED_put_rle_P(&oled, 0, 0, bench_splash, OLED_FILL | 1));
+  BENCH("OLED_put_rle_P 128x64 unaligned", 16,
+        OLED_put_rle_P(&oled, 0, 3, bench_splash, OLED_FILL | 1));
+  static uint8_t arena_buf[64];
+  OLED_arena arena;
+  OLED sprite;
+  OLED_arena_init(&arena, arena_buf, sizeof(arena_buf));
+  OLED_surface_init(&sprite, 32, 16, &arena);
+  OLED_put_circle(&sprite, 8, 8, 7, OLED_FILL | 1);
+  BENCH("OLED_composite 32x16 aligned", 16, OLED_composite(&oled, 40, 16, &sprite, OLED_FILL | 1));
+  BENCH("OLED_composite 32x16 unaligned", 16, OLED_composite(&oled, 40, 19, &sprite, 1));
+  BENCH("OLED_put_text 20 aligned", 16,
+        OLED_put_text(&oled, 0, 8, &OLED_font5x7, "01234567890123456789", OLED_FILL | 1));
+  BENCH("OLED_put_text 20 unaligned", 16,
+        OLED_put_text(&oled, 0, 11, &OLED_font5x7, "01234567890123456789", OLED_FILL | 1));
+  BENCH("OLED_put_text 20 transparent", 16,
+        OLED_put_text(&oled, 0, 11, &OLED_font5x7, "01234567890123456789", 1));
+  OLED_set_viewport(&oled, 16, 8, 79, 39);
+  BENCH("OLED_put_rectangle viewport", 64, OLED_put_rectangle(&oled, 0, 0, 127, 63, OLED_FILL | 1));
+  BENCH("OLED_put_text 20 viewport", 16,
+        OLED_put_text(&oled, 0, 3, &OLED_font5x7, "01234567890123456789", OLED_FILL | 1));
+  OLED_reset_viewport(&oled);
+  printf("%-28s %s\n", "OLED_put_ellipse extents", ellipse_extents_ok(&oled, fb) ? "ok" : "WRONG");
+
+  bench_refresh("OLED_refresh", false, &oled);
+  OLED_put_pixel(&oled, 100, 60, 1);
+  bench_refresh("OLED_refresh_dirty 1 pixel", true, &oled);
+  OLED_put_rectangle(&oled, 0, 0, 127, 63, OLED_FILL | 1);
+  bench_refresh("OLED_refresh_dirty full", true, &oled);
+
+  /* Display list pages are rendered by ISR into band. Unaligned images */
+  /* and text cross page edges, which must not write around the band	 */
+  static struct {
+    uint8_t lo[16];
+    uint8_t page[128];
+    uint8_t hi[16];
+  } band;
+  static uint8_t dlist[256];
+  memset(band.lo, 0xA5, sizeof(band.lo));
+  memset(band.hi, 0xA5, sizeof(band.hi));
+  OLED_set_dlist(&oled, band.page, dlist, sizeof(dlist));
+  OLED_fill_screen(&oled, 0);
+  OLED_put_bitmap_P(&oled, 8, 19, 32, 32, bench_icon, OLED_FILL | 1);
+  OLED_put_bitmap_P(&oled, 60, 5, 32, 32, bench_icon, OLED_XOR);
+  OLED_put_text(&oled, 0, 3, &OLED_font5x7, "01234567890123456789", OLED_FILL | 1);
+  OLED_put_text(&oled, 0, 59, &OLED_font5x7, "01234567890123456789", 1);
+  bench_refresh("OLED_refresh dlist", false, &oled);
+  OLED_set_dlist(&oled, NULL, NULL, 0);
+  bool is_band_ok = true;
+  for (uint8_t i = 0; i < sizeof(band.lo); i++)
+    if ((0xA5 != band.lo[i]) || (0xA5 != band.hi[i]))
+      is_band_ok = false;
+  printf("%-28s %s\n", "dlist band guard", is_band_ok ? "ok" : "CORRUPTED");
+
+  /* simavr quits when sleeping with interrupts disabled */
+  printf("done\n");
+  while (!(UCSR0A & (1 << TXC0)));
+  cli();
+  sleep_mode();
+  while (1) {
+  }
+}
@@ -24,7 +24,8 @@ int main()
     OLED_WITH_SPINLOCK(&oled) {
     OLED_put_roundRect(&oled, 10, 10, 40, 20, 5, OLED_FILL | 0 );
     OLED_put_roundRect(&oled, 14, 14, 90, 25, 7, 0);
-    //OLED_put_line(&oled,10, 10, 120, 25, OLED_FILL | 0 );
+    OLED_put_line(&oled, 10, 10, 120, 25, OLED_FILL | 0);
+    OLED_put_text(&oled, 10, 40, &OLED_font5x7, "Hello, world!", 0);
     }
     OLED_refresh(&oled);
 
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Converts monochrome image to compressed C array for OLED_put_rle_P.
+
+Input is PBM (P1 or P4, as written by `convert image.png image.pbm`), where
+black pixels are lit ones unless --invert is given. Output is C source with
+PROGMEM array, printed to stdout or written to --output.
+
+Format (see OLED_put_rle_P in oled.h): width, height, little-endian offset of
+runs of each page from the image start, then the runs. Page is a row of
+width column bytes, LSB being the top pixel. Control byte 0x00-0x7F is
+followed by that many plus one literal bytes, 0x80-0xFF by a byte repeated
+(ctrl & 0x7F) + 3 times. Runs do not cross pages.
+"""
+
+import argparse
+import re
+import sys
+
+MIN_REPEAT = 3
+MAX_REPEAT = 0x7F + MIN_REPEAT
+MAX_LITERAL = 0x80
+
+
+def read_pbm(data):
+    """Returns (width, height, rows of 0/1 pixels) of PBM file contents"""
+    fields = []
+    pos = 0
+    # Magic, width and height, separated by whitespace and comments
+    while len(fields) < 3:
+        match = re.compile(rb'\s*(#[^\n]*\n\s*)*(\S+)').match(data, pos)
+        if not match:
+            raise ValueError('truncated PBM header')
+        fields.append(match.group(2))
+        pos = match.end()
+    magic, width, height = fields[0], int(fields[1]), int(fields[2])
+    if magic == b'P4':
+        pos += 1  # Single whitespace before raster
+        stride = (width + 7) // 8
+        raster = data[pos:pos + stride * height]
+        if len(raster) < stride * height:
+            raise ValueError('truncated PBM raster')
+        rows = [[(raster[y * stride + x // 8] >> (7 - x % 8)) & 1
+                 for x in range(width)] for y in range(height)]
+    elif magic == b'P1':
+        bits = [c - ord('0') for c in re.sub(rb'#[^\n]*', b'', data[pos:]) if c in b'01']
+        if len(bits) < width * height:
+            raise ValueError('truncated PBM raster')
+        rows = [bits[y * width:(y + 1) * width] for y in range(height)]
+    else:
+        raise ValueError('not a PBM file (P1 or P4 expected)')
+    return width, height, rows
+
+
+def to_pages(width, height, rows):
+    """Packs pixel rows into GDDRAM pages of column bytes"""
+    pages = []
+    for page in range((height + 7) // 8):
+        line = []
+        for x in range(width):
+            byte = 0
+            for bit in range(8):
+                y = 8 * page + bit
+                if y < height and rows[y][x]:
+                    byte |= 1 << bit
+            line.append(byte)
+        pages.append(line)
+    return pages
+
+
+def encode_page(line):
+    """Run-length encodes one page"""
+    out = bytearray()
+    literal = []
+
+    def flush():
+        while literal:
+            part = literal[:MAX_LITERAL]
+            del literal[:MAX_LITERAL]
+            out.append(len(part) - 1)
+            out.extend(part)
+
+    i = 0
+    while i < len(line):
+        run = 1
+        while i + run < len(line) and line[i + run] == line[i] and run < MAX_REPEAT:
+            run += 1
+        if run >= MIN_REPEAT:
+            flush()
+            out.append(0x80 | (run - MIN_REPEAT))
+            out.append(line[i])
+        else:
+            literal.extend(line[i:i + run])
+        i += run
+    flush()
+    return out
+
+
+def decode_page(image, page, width):
+    """Expands one page back, the way the lib does. Used for self check"""
+    pos = image[2 + 2 * page] | (image[3 + 2 * page] << 8)
+    line = []
+    while len(line) < width:
+        ctrl = image[pos]
+        if ctrl & 0x80:
+            line.extend([image[pos + 1]] * ((ctrl & 0x7F) + MIN_REPEAT))
+            pos += 2
+        else:
+            line.extend(image[pos + 1:pos + 2 + ctrl])
+            pos += ctrl + 2
+    return line[:width]
+
+
+def encode(width, height, pages):
+    """Returns compressed image bytes"""
+    if not (0 < width <= 255 and 0 < height <= 255):
+        raise ValueError('image must be 1..255 pixels wide and tall')
+    runs = [encode_page(line) for line in pages]
+    image = bytearray([width, height])
+    offset = 2 + 2 * len(runs)
+    for page_runs in runs:
+        if offset > 0xFFFF:
+            raise ValueError('image is too big')
+        image += bytes([offset & 0xFF, offset >> 8])
+        offset += len(page_runs)
+    for page_runs in runs:
+        image += page_runs
+    for page, line in enumerate(pages):
+        assert decode_page(image, page, width) == line
+    return image
+
+
+def to_c(name, width, height, image):
+    lines = ['/* %dx%d image, %d bytes (%d uncompressed). Made by tools/oled_rle.py */'
+             % (width, height, len(image), width * ((height + 7) // 8)),
+             '#include <avr/pgmspace.h>',
+             '#include <stdint.h>',
+             '',
+             'const uint8_t %s[] PROGMEM = {' % name]
+    for i in range(0, len(image), 12):
+        lines.append('\t' + ', '.join('0x%02X' % b for b in image[i:i + 12]) + ',')
+    lines.append('};')
+    return '\n'.join(lines) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('input', help='PBM image (P1 or P4)')
+    parser.add_argument('-n', '--name', default='image', help='name of C array')
+    parser.add_argument('-o', '--output', help='C file to write, stdout by default')
+    parser.add_argument('-i', '--invert', action='store_true',
+                        help='white pixels are lit instead of black ones')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        width, height, rows = read_pbm(f.read())
+    if args.invert:
+        rows = [[1 - p for p in row] for row in rows]
+    image = encode(width, height, to_pages(width, height, rows))
+    source = to_c(args.name, width, height, image)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(source)
+    else:
+        sys.stdout.write(source)
+
+
+if __name__ == '__main__':
+    main()